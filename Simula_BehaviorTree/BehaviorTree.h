@@ -15,6 +15,8 @@ Author:	jlaing
 
 #include "CRC_Motor.h"
 #include "CRC_Sensors.h"
+#include "CRC_Odometry.h"
+#include "CRC_HeadingHold.h"
 #include "CRC_AudioManager.h"
 #include "CRC_Lights.h"
 #include "CRC_Logger.h"
@@ -149,7 +151,7 @@ private:
 			if (hardwareState.batteryVoltage < crcHardware.lowBatteryVoltage) {
 				crcHardware.announceBatteryVoltage();
 				nodeActive = true;
-				crcAudio.playRandomAudio("effects/PwrDn_", 10, ".mp3");
+				crcAudio.post(CRC_AudioCatalog::AUDIO_POWER_DOWN, crcAudio.AUDIO_PRIORITY_HIGH, crcAudio.AUDIO_PREEMPT);
 			}
 		}
 		//TODO: add ability to reactivate when batteries are good.
@@ -159,14 +161,13 @@ private:
 class Orientation_Check : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
-	const int Z_Orient_Min = 15000;
 	virtual bool run() override {
 
-		if ((!motors.active()) && (!crcAudio.isPlayingAudio()) && (crcSensors.imu.accelData.z < Z_Orient_Min)) {
-			crcAudio.playRandomAudio(F("emotions/scare_"), 9, F(".mp3"));
+		if ((!motors.active()) && crcSensors.orientation.isTilted()) {
+			// Only counts as handled if the scare was not dropped behind another sound
+			nodeActive = crcAudio.post(CRC_AudioCatalog::AUDIO_SCARE, crcAudio.AUDIO_PRIORITY_NORMAL, crcAudio.AUDIO_DROP);
 			//Serial.print("Z: ");
 			//Serial.println(sensors.lsm.accelData.z);
-			nodeActive = true;
 		}
 		else {
 			nodeActive = false;
@@ -185,6 +186,81 @@ private:
 		Serial.print("Temp: "); Serial.print((int)sensors.lsm.temperature);    Serial.println(" ");*/
 	}
 };
+class Stall_Recovery : public Behavior_Tree::Node {
+	//Runs when a wheel is driven but not turning, e.g. pushing a wall the IR sensors missed.
+public:
+	static const uint8_t RESPONSE_STOP = 0;		// Cut power and rest
+	static const uint8_t RESPONSE_BACK_OFF = 1;	// Reverse away from the obstruction, then rest
+	Stall_Recovery(uint8_t response) : _response(response) {}
+private:
+	uint8_t _response;
+	bool nodeActive = false;
+	bool resting = false;
+	const int32_t backDistance = 40;	// mm
+	const long backTimeout = 800;
+	const long restDuration = 1000;
+	unsigned long currentTime;
+	unsigned long nodeStartTime = 0;
+	int32_t startDistance;
+	virtual bool run() override {
+		currentTime = millis();
+		if (!nodeActive) {
+			if (motors.stalled()) {
+				crcLogger.logF(crcLogger.LOG_INFO, F("Stall detected, left %d right %d."),
+					motors.motorLeft->stalled(), motors.motorRight->stalled());
+				nodeActive = true;
+				nodeStartTime = currentTime;
+				motors.emergencyStop();
+				resting = (_response == RESPONSE_STOP);
+				if (!resting) {
+					startDistance = crcOdometry.distance();
+					motors.setPowerNow(-simulation.straightSpeed, -simulation.straightSpeed);
+				}
+			}
+		}
+		else {
+			if (!resting && ((startDistance - crcOdometry.distance() >= backDistance) || motors.stalled() || (nodeStartTime + backTimeout < currentTime))) {
+				motors.emergencyStop();
+				resting = true;
+				nodeStartTime = currentTime;
+			}
+			if (resting && (nodeStartTime + restDuration < currentTime)) {
+				crcLogger.logF(crcLogger.LOG_INFO, F("Stall recovery complete."));
+				nodeActive = false;
+				resting = false;
+				nodeStartTime = 0;
+			}
+		}
+		return nodeActive;
+	}
+};
+class Edge_Fault_Hold : public Behavior_Tree::Node {
+	//An edge sensor that can't be trusted can't see a cliff, or sees one forever.
+	//Stop and keep every other motion node out until the sensors are restarted.
+private:
+	bool nodeActive = false;
+	virtual bool run() override {
+		bool edgeDegraded = crcSensors.degraded(CRC_Sensors::CHANNEL_EDGE_LEFT) || crcSensors.degraded(CRC_Sensors::CHANNEL_EDGE_RIGHT);
+		if (edgeDegraded) {
+			if (!nodeActive) {
+				crcLogger.logF(crcLogger.LOG_WARN, F("Edge sensor degraded, holding still. Faults left 0x%02x right 0x%02x."),
+					crcSensors.channelFaults(CRC_Sensors::CHANNEL_EDGE_LEFT), crcSensors.channelFaults(CRC_Sensors::CHANNEL_EDGE_RIGHT));
+				nodeActive = true;
+				motors.emergencyStop();
+			}
+			// Random motion and the perimeter reflexes wait on these
+			simulation.motionActive = true;
+			simulation.perimeterActive = true;
+		}
+		else if (nodeActive) {
+			crcLogger.logF(crcLogger.LOG_INFO, F("Edge sensors recovered, motion released."));
+			nodeActive = false;
+			simulation.motionActive = false;
+			simulation.perimeterActive = false;
+		}
+		return nodeActive;
+	}
+};
 class Cliff_Center : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
@@ -200,7 +276,8 @@ private:
 				nodeActive = true;
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff center detected."));
 				nodeStartTime = currentTime;
-				motors.setPower(-simulation.straightSpeed, -simulation.straightSpeed);
+				motors.emergencyStop();
+				motors.setPowerNow(-simulation.straightSpeed, -simulation.straightSpeed);
 			}
 		}
 		else
@@ -218,10 +295,15 @@ private:
 class Cliff_Left : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
-	const long backDuration = 400;
-	const long turnDuration = 400;
+	const int32_t backDistance = 60;	// mm
+	const int32_t turnAngle = 60000;	// millidegrees
+	const long backTimeout = 1000;		// Give up on a distance/angle that isn't reached
+	const long turnTimeout = 1000;
 	unsigned long currentTime;
 	unsigned long nodeStartTime = 0;
+	unsigned long turnStartTime = 0;
+	int32_t startDistance;
+	int32_t startHeading;
 	bool turnStarted = false;
 	virtual bool run() override {
 
@@ -232,16 +314,20 @@ private:
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff left detected."));
 				nodeStartTime = currentTime;
 				nodeActive = true;
-				motors.setPower(-simulation.straightSpeed, -simulation.straightSpeed);
+				startDistance = crcOdometry.distance();
+				motors.emergencyStop();
+				motors.setPowerNow(-simulation.straightSpeed, -simulation.straightSpeed);
 			}
 		}
 		else {
-			if ((nodeStartTime + backDuration < currentTime) && !turnStarted) {
+			if (!turnStarted && ((startDistance - crcOdometry.distance() >= backDistance) || (nodeStartTime + backTimeout < currentTime))) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff left turning."));
 				turnStarted = true;
+				turnStartTime = currentTime;
+				startHeading = crcOdometry.heading();
 				motors.setPower(simulation.turnSpeed, -simulation.turnSpeed);
 			}
-			if (nodeStartTime + backDuration + turnDuration < currentTime) {
+			if (turnStarted && ((abs(crcOdometry.turnedSince(startHeading)) >= turnAngle) || (turnStartTime + turnTimeout < currentTime))) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff left complete."));
 				nodeStartTime = 0;
 				motors.allStop();
@@ -255,10 +341,15 @@ private:
 class Cliff_Right : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
-	const long backDuration = 400;
-	const long turnDuration = 400;
+	const int32_t backDistance = 60;	// mm
+	const int32_t turnAngle = 60000;	// millidegrees
+	const long backTimeout = 1000;		// Give up on a distance/angle that isn't reached
+	const long turnTimeout = 1000;
 	unsigned long currentTime;
 	unsigned long nodeStartTime = 0;
+	unsigned long turnStartTime = 0;
+	int32_t startDistance;
+	int32_t startHeading;
 	bool turnStarted = false;
 	virtual bool run() override {
 
@@ -268,16 +359,20 @@ private:
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff right detected."));
 				nodeStartTime = currentTime;
 				nodeActive = true;
-				motors.setPower(-simulation.straightSpeed, -simulation.straightSpeed);
+				startDistance = crcOdometry.distance();
+				motors.emergencyStop();
+				motors.setPowerNow(-simulation.straightSpeed, -simulation.straightSpeed);
 			}
 		}
 		else {
-			if ((nodeStartTime + backDuration < currentTime) && !turnStarted) {
+			if (!turnStarted && ((startDistance - crcOdometry.distance() >= backDistance) || (nodeStartTime + backTimeout < currentTime))) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff right turning."));
 				turnStarted = true;
+				turnStartTime = currentTime;
+				startHeading = crcOdometry.heading();
 				motors.setPower(-simulation.turnSpeed, simulation.turnSpeed);
 			}
-			if (nodeStartTime + backDuration + turnDuration < currentTime) {
+			if (turnStarted && ((abs(crcOdometry.turnedSince(startHeading)) >= turnAngle) || (turnStartTime + turnTimeout < currentTime))) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Cliff right complete."));
 				nodeStartTime = 0;
 				motors.allStop();
@@ -291,14 +386,13 @@ private:
 class Perimeter_Center : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
-	uint8_t alarmCM = 11;
 	const long duration = 200;
 	unsigned long currentTime;
 	unsigned long nodeStartTime = 0;
 	virtual bool run() override {
 		currentTime = millis();
 		if (!nodeActive) {
-			if ((crcSensors.irFrontCM < alarmCM && crcSensors.irFrontCM > crcHardware.irMinimumCM) && (!simulation.perimeterActive)) {
+			if (crcSensors.contactAlarm(CRC_Sensors::CHANNEL_FRONT) && !simulation.perimeterActive) {
 				nodeStartTime = currentTime;
 				nodeActive = true;
 				simulation.perimeterActive = true;
@@ -318,7 +412,7 @@ private:
 			}
 		}
 		else {
-			if ((nodeStartTime + duration < currentTime) && (crcSensors.irFrontCM >= alarmCM)) {
+			if ((nodeStartTime + duration < currentTime) && !crcSensors.perimeterAlarm(CRC_Sensors::CHANNEL_FRONT)) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Perimeter center complete."));
 				motors.allStop();
 				nodeStartTime = 0;
@@ -332,14 +426,13 @@ private:
 class Perimeter_Left : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
-	uint8_t alarmCM = 11;
 	const long duration = 200;
 	unsigned long currentTime;
 	unsigned long nodeStartTime = 0;
 	virtual bool run() override {
 		currentTime = millis();
 		if (!nodeActive) {
-			if ((crcSensors.irLeftFrontCM < alarmCM && crcSensors.irLeftFrontCM > crcHardware.irMinimumCM) && !simulation.perimeterActive) {
+			if (crcSensors.contactAlarm(CRC_Sensors::CHANNEL_LEFT_FRONT) && !simulation.perimeterActive) {
 				nodeStartTime = currentTime;
 				nodeActive = true;
 				simulation.perimeterActive = true;
@@ -348,7 +441,7 @@ private:
 			}
 		}
 		else {
-			if ((nodeStartTime + duration < currentTime) && crcSensors.irLeftFrontCM >= alarmCM) {
+			if ((nodeStartTime + duration < currentTime) && !crcSensors.perimeterAlarm(CRC_Sensors::CHANNEL_LEFT_FRONT)) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Perimeter left front complete."));
 				motors.allStop();
 				nodeStartTime = 0;
@@ -362,14 +455,13 @@ private:
 class Perimeter_Right : public Behavior_Tree::Node {
 private:
 	bool nodeActive = false;
-	uint8_t alarmCM = 11;
 	const long duration = 200;
 	unsigned long currentTime;
 	unsigned long nodeStartTime = 0;
 	virtual bool run() override {
 		currentTime = millis();
 		if (!nodeActive) {
-			if ((crcSensors.irRightFrontCM < alarmCM && crcSensors.irRightFrontCM > crcHardware.irMinimumCM) && !simulation.perimeterActive) {
+			if (crcSensors.contactAlarm(CRC_Sensors::CHANNEL_RIGHT_FRONT) && !simulation.perimeterActive) {
 				nodeStartTime = currentTime;
 				nodeActive = true;
 				simulation.perimeterActive = true;
@@ -378,7 +470,7 @@ private:
 			}
 		}
 		else {
-			if ((nodeStartTime + duration < currentTime) && crcSensors.irRightFrontCM >= alarmCM) {
+			if ((nodeStartTime + duration < currentTime) && !crcSensors.perimeterAlarm(CRC_Sensors::CHANNEL_RIGHT_FRONT)) {
 				crcLogger.logF(crcLogger.LOG_INFO, F("Perimeter right front complete."));
 				motors.allStop();
 				nodeStartTime = 0;
@@ -445,7 +537,7 @@ private:
 				simulation.motionActive = true;
 				nodeStartTime = currentTime;
 				crcLogger.logF(crcLogger.LOG_INFO, F("Forward_Random active, duration = %ul ms."), duration);
-				motors.setPower(simulation.straightSpeed, simulation.straightSpeed);
+				crcHeadingHold.driveStraight(simulation.straightVelocity);
 			}
 		}
 		if (nodeActive && (nodeStartTime + duration < currentTime)) {
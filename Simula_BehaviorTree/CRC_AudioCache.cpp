@@ -0,0 +1,53 @@
+/***************************************************
+Uses: Keeps the leading SD blocks of the clip each category
+plays next, loaded while the player is idle, so a requested
+effect starts from SRAM while the rest of the file streams in
+behind it.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_AudioCache.h"
+
+CRC_AudioCache::CRC_AudioCache() {
+	for (uint8_t category = 0; category < CRC_AudioCatalog::AUDIO_CATEGORY_COUNT; category++) {
+		release(category);
+	}
+	hits = 0;
+	misses = 0;
+}
+
+#if AUDIO_CACHE_BLOCKS > 0
+
+int8_t CRC_AudioCache::lookup(uint8_t category, uint8_t clip) {
+	if (_slots[category].clip == clip && _slots[category].length > 0) {
+		hits++;
+		return category;
+	}
+	misses++;
+	return NO_SLOT;
+}
+
+uint8_t * CRC_AudioCache::reserve(uint8_t category, uint8_t clip) {
+	_slots[category].clip = clip;
+	_slots[category].length = 0;
+	return _data[category];
+}
+
+void CRC_AudioCache::release(uint8_t category) {
+	_slots[category].clip = CRC_AudioCatalog::NO_CLIP;
+	_slots[category].length = 0;
+}
+#endif
+
+uint16_t CRC_AudioCache::hitRate() {
+	unsigned long lookups = hits + misses;
+	if (lookups == 0) {
+		return 0;
+	}
+	return hits * 1000UL / lookups;
+}
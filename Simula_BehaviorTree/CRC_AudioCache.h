@@ -0,0 +1,80 @@
+/***************************************************
+Uses: Keeps the leading SD blocks of the clip each category
+plays next, loaded while the player is idle, so a requested
+effect starts from SRAM while the rest of the file streams in
+behind it.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_AUDIOCACHE_h
+#define _CRC_AUDIOCACHE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include "CRC_AudioCatalog.h"
+
+// Leading blocks kept per category, each costs 512 bytes of SRAM a category.
+// 0 compiles the cache out, every request then reads its clip from the start.
+#define AUDIO_CACHE_BLOCKS		1
+#define AUDIO_CACHE_BLOCK_LEN	512
+#define AUDIO_CACHE_LEN			(AUDIO_CACHE_BLOCKS * AUDIO_CACHE_BLOCK_LEN)
+
+// A hit is copied straight into the two playback sectors.
+static_assert(AUDIO_CACHE_BLOCKS <= 2, "AUDIO_CACHE_BLOCKS must be 0, 1 or 2");
+
+class CRC_AudioCache {
+private:
+	// One slot per category, indexed by CRC_AudioCatalog::AUDIO_CATEGORY
+	struct AUDIO_CACHE_SLOT {
+		uint8_t clip;		// Catalog index, CRC_AudioCatalog::NO_CLIP if empty
+		uint16_t length;	// Bytes held, 0 until loaded
+	};
+
+#if AUDIO_CACHE_BLOCKS > 0
+	AUDIO_CACHE_SLOT _slots[CRC_AudioCatalog::AUDIO_CATEGORY_COUNT];
+	uint8_t _data[CRC_AudioCatalog::AUDIO_CATEGORY_COUNT][AUDIO_CACHE_LEN];
+#endif
+public:
+	static const int8_t NO_SLOT = -1;
+
+	CRC_AudioCache();
+#if AUDIO_CACHE_BLOCKS > 0
+	// Clip loaded for the category, NO_CLIP until one is.
+	inline uint8_t clip(uint8_t category) { return (_slots[category].length > 0) ? _slots[category].clip : CRC_AudioCatalog::NO_CLIP; }
+	// Nothing loaded or being loaded for the category.
+	inline boolean empty(uint8_t category) { return _slots[category].clip == CRC_AudioCatalog::NO_CLIP; }
+	// Slot holding the clip's leading blocks, NO_SLOT on a miss.
+	int8_t lookup(uint8_t category, uint8_t clip);
+	// Tag the category's slot for the clip, then read up to AUDIO_CACHE_LEN bytes into
+	// the buffer returned and hand the count to loaded().
+	uint8_t * reserve(uint8_t category, uint8_t clip);
+	inline void loaded(uint8_t category, uint16_t length) { _slots[category].length = length; }
+	// The category's clip has been played, empty the slot for the next one.
+	void release(uint8_t category);
+	inline const uint8_t * data(int8_t slot) { return _data[slot]; }
+	inline uint16_t length(int8_t slot) { return _slots[slot].length; }
+#else
+	// Compiled out, nothing is ever held
+	inline uint8_t clip(uint8_t category) { return CRC_AudioCatalog::NO_CLIP; }
+	inline int8_t lookup(uint8_t category, uint8_t clip) { misses++; return NO_SLOT; }
+	inline void release(uint8_t category) {}
+#endif
+
+	// Hits per thousand lookups
+	uint16_t hitRate();
+
+	// Diagnostics
+	unsigned long hits;
+	unsigned long misses;
+};
+
+#endif
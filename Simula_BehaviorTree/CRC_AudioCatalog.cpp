@@ -0,0 +1,264 @@
+/***************************************************
+Uses: Boot time index of the audio clips on the SD card. Clips
+come from AUDIO.PAK when the packer tool has written one, and are
+streamed by raw block address with no FAT lookups. Otherwise each
+clip category directory is scanned once, so playing a clip is a
+random pick plus an open by directory index.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_AudioCatalog.h"
+#include "CRC_Logger.h"
+
+struct AUDIO_CATEGORY_DEF {
+	char dir[9];		// Directory in the root
+	char prefix[7];		// File name before the two digit clip number
+	uint8_t expected;	// Clips 01..expected should be present
+};
+
+// Layout of AUDIO.PAK, little endian. Block 0 holds the header and the
+// entries, sorted by category. Each clip starts on a block boundary.
+struct AUDIO_PACK_HEADER {
+	char magic[4];		// "SPAK"
+	uint8_t version;
+	uint8_t clipCount;
+	uint16_t reserved;
+};
+struct AUDIO_PACK_ENTRY {
+	uint8_t category;	// CRC_AudioCatalog::AUDIO_CATEGORY
+	uint8_t number;		// NN of the clip it was packed from
+	uint16_t reserved;
+	uint32_t offset;	// Blocks from the start of the pack
+	uint32_t size;		// bytes
+};
+#define AUDIO_PACK_VERSION	1
+
+// Clips are named <dir>/<prefix>NN.MP3
+static const AUDIO_CATEGORY_DEF AUDIO_CATEGORIES[] PROGMEM = {
+	{ "EFFECTS", "PWRUP_", 10 },
+	{ "EFFECTS", "PWRDN_", 10 },
+	{ "EMOTIONS", "SCARE_", 9 },
+};
+
+CRC_AudioCatalog::CRC_AudioCatalog() {
+	_ready = false;
+	_packBlock = 0;
+	_clipCount = 0;
+	memset(_categories, 0, sizeof(_categories));
+}
+
+boolean CRC_AudioCatalog::begin(uint8_t chipSelect) {
+	_ready = false;
+	_clipCount = 0;
+	if (!_card.init(SPI_FULL_SPEED, chipSelect) || !_volume.init(&_card) || !_root.openRoot(&_volume)) {
+		crcLogger.log(crcLogger.LOG_ERROR, F("Audio catalog could not open the SD card."));
+		return false;
+	}
+	_ready = true;
+
+	if (loadPack()) {
+		crcLogger.logF(crcLogger.LOG_INFO, F("Audio catalog: %u packed clips at block %lu."), _clipCount, _packBlock);
+		return true;
+	}
+	for (uint8_t category = 0; category < AUDIO_CATEGORY_COUNT; category++) {
+		scanCategory(category);
+	}
+	crcLogger.logF(crcLogger.LOG_INFO, F("Audio catalog: %u clips."), _clipCount);
+	return true;
+}
+
+boolean CRC_AudioCatalog::loadPack() {
+	_packBlock = 0;
+	_clipCount = 0;
+	memset(_categories, 0, sizeof(_categories));
+	SdFile pack;
+	if (!pack.open(&_root, AUDIO_PACK_NAME, O_READ)) {
+		return false;
+	}
+
+	// Raw streaming needs every block in one run, which a copy onto a
+	// freshly formatted card gives.
+	uint32_t firstBlock;
+	uint32_t lastBlock;
+	AUDIO_PACK_HEADER header;
+	if (!pack.contiguousRange(&firstBlock, &lastBlock)) {
+		crcLogger.log(crcLogger.LOG_WARN, F("AUDIO.PAK is fragmented, copy it to a freshly formatted card."));
+		pack.close();
+		return false;
+	}
+	if (pack.read(&header, sizeof(header)) != sizeof(header) || memcmp(header.magic, "SPAK", 4) != 0
+		|| header.version != AUDIO_PACK_VERSION || header.clipCount > AUDIO_CATALOG_MAX_CLIPS) {
+		crcLogger.log(crcLogger.LOG_WARN, F("AUDIO.PAK header not recognised."));
+		pack.close();
+		return false;
+	}
+
+	uint32_t found[AUDIO_CATEGORY_COUNT];
+	memset(found, 0, sizeof(found));
+	uint32_t packBlocks = lastBlock - firstBlock + 1;
+	AUDIO_PACK_ENTRY entry;
+	for (uint8_t i = 0; i < header.clipCount; i++) {
+		if (pack.read(&entry, sizeof(entry)) != sizeof(entry) || entry.category >= AUDIO_CATEGORY_COUNT
+			|| (i > 0 && entry.category < _clips[i - 1].category) || entry.offset == 0
+			|| entry.offset + ((entry.size + 511) >> 9) > packBlocks) {
+			crcLogger.logF(crcLogger.LOG_WARN, F("AUDIO.PAK entry %u is bad."), i);
+			pack.close();
+			_clipCount = 0;
+			memset(_categories, 0, sizeof(_categories));
+			return false;
+		}
+		AUDIO_CATEGORY_INDEX & index = _categories[entry.category];
+		if (index.count == 0) {
+			index.first = _clipCount;
+		}
+		index.count++;
+		AUDIO_CLIP & clip = _clips[_clipCount++];
+		clip.category = entry.category;
+		clip.dirIndex = 0;
+		clip.startBlock = firstBlock + entry.offset;
+		clip.size = entry.size;
+		if (entry.number < 32) {
+			found[entry.category] |= 1UL << entry.number;
+		}
+	}
+	pack.close();
+	_packBlock = firstBlock;
+
+	for (uint8_t category = 0; category < AUDIO_CATEGORY_COUNT; category++) {
+		reportMissing(category, found[category]);
+	}
+	return true;
+}
+
+void CRC_AudioCatalog::scanCategory(uint8_t category) {
+	AUDIO_CATEGORY_DEF def;
+	memcpy_P(&def, &AUDIO_CATEGORIES[category], sizeof(def));
+	AUDIO_CATEGORY_INDEX & index = _categories[category];
+	index.first = _clipCount;
+	index.count = 0;
+
+	char name83[11];
+	dir_t entry;
+	toName83(def.dir, name83);
+	int16_t dirIndex = findEntry(_root, name83, entry);
+	SdFile dir;
+	if (dirIndex < 0 || !dir.open(&_root, dirIndex, O_READ)) {
+		crcLogger.logF(crcLogger.LOG_WARN, F("Audio directory %s missing."), def.dir);
+		return;
+	}
+	index.dirIndex = dirIndex;
+
+	uint8_t prefixLength = strlen(def.prefix);
+	uint32_t found = 0;
+	while (dir.readDir(&entry) > 0) {
+		const uint8_t * name = entry.name;
+		if (!DIR_IS_FILE(&entry) || memcmp(name, def.prefix, prefixLength) != 0
+			|| !isDigit(name[prefixLength]) || !isDigit(name[prefixLength + 1])
+			|| memcmp(&name[8], "MP3", 3) != 0) {
+			continue;
+		}
+		uint8_t number = (name[prefixLength] - '0') * 10 + (name[prefixLength + 1] - '0');
+		if (_clipCount >= AUDIO_CATALOG_MAX_CLIPS) {
+			crcLogger.log(crcLogger.LOG_WARN, F("Audio catalog full."));
+			break;
+		}
+		AUDIO_CLIP & clip = _clips[_clipCount++];
+		clip.category = category;
+		clip.dirIndex = (dir.curPosition() >> 5) - 1;
+		clip.startBlock = 0;
+		clip.size = entry.fileSize;
+		index.count++;
+		if (number < 32) {
+			found |= 1UL << number;
+		}
+	}
+	dir.close();
+	reportMissing(category, found);
+}
+
+void CRC_AudioCatalog::reportMissing(uint8_t category, uint32_t found) {
+	AUDIO_CATEGORY_DEF def;
+	memcpy_P(&def, &AUDIO_CATEGORIES[category], sizeof(def));
+
+	// Catch missing clips now rather than at play time
+	for (uint8_t number = 1; number <= def.expected; number++) {
+		if (!(found & (1UL << number))) {
+			crcLogger.logF(crcLogger.LOG_WARN, F("Audio clip %s/%s%02u.MP3 missing."), def.dir, def.prefix, number);
+		}
+	}
+}
+
+int16_t CRC_AudioCatalog::findEntry(SdFile & dir, const char * name83, dir_t & entry) {
+	dir.rewind();
+	while (dir.readDir(&entry) > 0) {
+		if (memcmp(entry.name, name83, 11) == 0) {
+			return (dir.curPosition() >> 5) - 1;
+		}
+	}
+	return -1;
+}
+
+void CRC_AudioCatalog::toName83(const char * name, char * name83) {
+	// Directory names here have no extension, so just space pad.
+	memset(name83, ' ', 11);
+	for (uint8_t i = 0; i < 8 && name[i]; i++) {
+		name83[i] = name[i];
+	}
+}
+
+uint8_t CRC_AudioCatalog::randomClip(uint8_t category, uint8_t preferred) {
+	if (category >= AUDIO_CATEGORY_COUNT || _categories[category].count == 0) {
+		return NO_CLIP;
+	}
+	if (preferred < _clipCount && _clips[preferred].category == category) {
+		return preferred;
+	}
+	return _categories[category].first + random(_categories[category].count);
+}
+
+boolean CRC_AudioCatalog::openClip(uint8_t clip, SdFile & file) {
+	if (!_ready || clip >= _clipCount || _clips[clip].startBlock != 0) {
+		return false;
+	}
+	SdFile dir;
+	if (!dir.open(&_root, _categories[_clips[clip].category].dirIndex, O_READ)) {
+		return false;
+	}
+	boolean opened = file.open(&dir, _clips[clip].dirIndex, O_READ);
+	dir.close();
+	return opened;
+}
+
+boolean CRC_AudioCatalog::openPath(const char * path, SdFile & file) {
+	if (!_ready) {
+		return false;
+	}
+	SdFile parent = _root;
+	char name[13];
+	while (true) {
+		while (*path == '/') {
+			path++;
+		}
+		const char * end = strchr(path, '/');
+		uint8_t length = end ? end - path : strlen(path);
+		if (length == 0 || length >= sizeof(name)) {
+			return false;
+		}
+		memcpy(name, path, length);
+		name[length] = 0;
+		if (!end) {
+			return file.open(&parent, name, O_READ);
+		}
+		SdFile child;
+		if (!child.open(&parent, name, O_READ)) {
+			return false;
+		}
+		parent = child;
+		path = end;
+	}
+}
@@ -0,0 +1,98 @@
+/***************************************************
+Uses: Boot time index of the audio clips on the SD card. Clips
+come from AUDIO.PAK when the packer tool has written one, and are
+streamed by raw block address with no FAT lookups. Otherwise each
+clip category directory is scanned once, so playing a clip is a
+random pick plus an open by directory index.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_AUDIOCATALOG_h
+#define _CRC_AUDIOCATALOG_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <SD.h>
+
+#define AUDIO_CATALOG_MAX_CLIPS	32
+#define AUDIO_PACK_NAME			"AUDIO.PAK"	// Written by tools/pack_audio.py
+
+class CRC_AudioCatalog {
+public:
+	// Order matches the category table in CRC_AudioCatalog.cpp
+	enum AUDIO_CATEGORY : uint8_t {
+		AUDIO_POWER_UP,
+		AUDIO_POWER_DOWN,
+		AUDIO_SCARE,
+		AUDIO_CATEGORY_COUNT
+	};
+	static const uint8_t NO_CLIP = 0xFF;
+
+private:
+	struct AUDIO_CLIP {
+		uint8_t category;
+		uint16_t dirIndex;		// Entry index within the category directory
+		uint32_t startBlock;	// Card block of a packed clip, 0 if read through its file
+		uint32_t size;			// bytes
+	};
+	struct AUDIO_CATEGORY_INDEX {
+		uint16_t dirIndex;		// Directory's entry index within the root
+		uint8_t first;			// First clip in _clips
+		uint8_t count;
+	};
+
+	// Our own handle on the card, the SD library keeps its root private.
+	// SdVolume's block cache and its card pointer (sdCard_) are static, shared
+	// by every volume. Once begin() has run, SD.open() and every File read go
+	// through _card, not the SD library's own card, so this object must live as
+	// long as anything uses SD. begin() re-initialises the card, so call it
+	// before any file is open.
+	Sd2Card _card;
+	SdVolume _volume;
+	SdFile _root;
+	boolean _ready;
+	uint32_t _packBlock;		// First card block of AUDIO.PAK, 0 if not in use
+	AUDIO_CLIP _clips[AUDIO_CATALOG_MAX_CLIPS];
+	uint8_t _clipCount;
+	AUDIO_CATEGORY_INDEX _categories[AUDIO_CATEGORY_COUNT];
+
+	boolean loadPack();
+	void scanCategory(uint8_t category);
+	void reportMissing(uint8_t category, uint32_t found);
+	int16_t findEntry(SdFile & dir, const char * name83, dir_t & entry);
+	static void toName83(const char * name, char * name83);
+public:
+	CRC_AudioCatalog();
+	// Index every clip category. Call once SD.begin() has succeeded.
+	boolean begin(uint8_t chipSelect);
+	inline boolean ready() { return _ready; }
+	inline uint8_t clipCount() { return _clipCount; }
+	inline uint8_t clipCount(uint8_t category) { return _categories[category].count; }
+	inline uint32_t clipSize(uint8_t clip) { return _clips[clip].size; }
+	inline uint8_t clipCategory(uint8_t clip) { return _clips[clip].category; }
+	inline uint32_t clipBlock(uint8_t clip) { return _clips[clip].startBlock; }
+	inline boolean isPacked() { return _packBlock != 0; }
+	inline uint32_t packBlock() { return _packBlock; }
+
+	// Any clip from the category, NO_CLIP if it has none. The preferred clip,
+	// one already cached, is taken when it belongs to the category.
+	uint8_t randomClip(uint8_t category, uint8_t preferred = NO_CLIP);
+	// Open a catalogued clip by directory index. Packed clips have no file
+	// of their own, stream them from clipBlock() with readBlock().
+	boolean openClip(uint8_t clip, SdFile & file);
+	// Read one 512 byte block straight off the card. Caller holds the SD bus.
+	inline boolean readBlock(uint32_t block, uint8_t * buffer) { return _card.readBlock(block, buffer); }
+	// Open a file by slash separated path, for anything not catalogued.
+	boolean openPath(const char * path, SdFile & file);
+};
+
+#endif
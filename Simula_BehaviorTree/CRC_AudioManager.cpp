@@ -15,7 +15,8 @@ See README.md for license details
 #include "CRC_AudioManager.h"
 #include "CRC_Hardware.h"
 #include "CRC_Logger.h"
-#include <SPI.h>
+#include "CRC_SpiBus.h"
+#include "CRC_FastGpio.h"
 
 // START VS1053 Definitions (TODO, delete/comment out what is not used)
 #define VS1053_REG_MODE  0x00
@@ -52,28 +53,59 @@ See README.md for license details
 #define VS1053_SCI_AICTRL1 0x0D
 #define VS1053_SCI_AICTRL2 0x0E
 #define VS1053_SCI_AICTRL3 0x0F
-#define VS1053_CONTROL_SPI_SETTING  SPISettings(250000,  MSBFIRST, SPI_MODE0)
-#define VS1053_DATA_SPI_SETTING     SPISettings(8000000, MSBFIRST, SPI_MODE0)
+#define VS1053_PARAM_END_FILL_BYTE 0x1E06
+#define VS1053_FINISH_CHUNKS 65		// 2080 bytes, at least the datasheet's 2052 after the last byte
+#define VS1053_CANCEL_CHUNKS 64		// 2048 bytes, the datasheet's limit before a reset
+#define VS1053_FILL_TIMEOUT_MS 50	// DREQ low this long while flushing, reset the codec
+#define VS1053_RESET_MS 10			// Hardware reset pulse
+#define VS1053_BOOT_TIMEOUT_MS 100	// Longest wait for DREQ after a reset
+#define VS1053_SCI_SLOW_HZ 250000	// 12.288 MHz XTALI / 7 with margin
+#define VS1053_SCI_FAST_HZ 4000000	// CLKF 3.0x, CLKI / 7 is about 5.2 MHz
 
 // END VS1053 Definitions
-boolean CRC_AudioManagerClass::init() {
+
+// DREQ has to sit on port B, the pins behind PCINT0_vect.
+static_assert(CRC_FastGpio::port(CRC_HardwareClass::vs1053_dreq) == GPIO_PORTB, "VS1053 DREQ must be a PCINT0 pin");
+#define VS1053_DREQ_PCMASK	CRC_FastGpio::mask(CRC_HardwareClass::vs1053_dreq)
+
+ISR(PCINT0_vect) {
+	crcAudio.onDataRequest();
+}
+
+// A feed cut short by its budget leaves DREQ high, so no pin change edge follows.
+// Timer0 compare B brings the feeder back instead. Compare A is the button LED's
+// PWM on pin 13, B's pin 4 is the SD select and never PWM, so OCR0B is free.
+#define VS1053_REFEED_TICKS	25		// Timer0 ticks 4 us, ~100 us for the loop and other interrupts
+
+ISR(TIMER0_COMPB_vect) {
+	TIMSK0 &= ~_BV(OCIE0B);
+	crcAudio.onDataRequest();
+}
+
+// DREQ edges that found the bus busy are fed once it is released.
+static void feedAfterBusRelease() {
+	crcAudio.feedAudioBuffer(crcHardware.audioFeedBudgetMicros);
+}
+
+void CRC_AudioManagerClass::init() {
 	_isPlayingAudio = false;
+	_state = AUDIO_OFF;
+	_volume = 0;
+	_flushAfterCancel = false;
+	_streamBlock = 0;
+	resetSectors();
+	_queueCount = 0;
+	_currentPriority = AUDIO_PRIORITY_LOW;
+	feeds = 0;
+	budgetCutoffs = 0;
+	underruns = 0;
+	longestFeedMicros = 0;
+	_statsWindowStart = millis();
+	droppedRequests = 0;
+	cancelResets = 0;
+	hardwareState.audioPlayer = false;
+	crcSpiBus.setReleaseHandler(feedAfterBusRelease);
 	reset();
-	delay(100);
-	uint8_t vs1053begin = (sciRead(VS1053_REG_STATUS) >> 4) & 0x0F;
-
-	// Dump on init
-	// dumpRegs();
-	if (vs1053begin == 4) {
-		hardwareState.audioPlayer = true;
-		crcLogger.log(crcLogger.LOG_INFO, F("Audio initialized."));
-		return true;
-	}
-	else {
-		hardwareState.audioPlayer = false;
-		crcLogger.log(crcLogger.LOG_ERROR, F("Audio chip not detected."));
-		return false;
-	}
 }
 void CRC_AudioManagerClass::dumpRegs(void) {
 	Serial.begin(115200, SERIAL_8N1);
@@ -83,162 +115,465 @@ void CRC_AudioManagerClass::dumpRegs(void) {
 	Serial.print(F("Vol. = 0x")); Serial.println(sciRead(VS1053_REG_VOLUME), HEX);
 	Serial.end();
 }
+void CRC_AudioManagerClass::setState(AUDIO_STATE state) {
+	_state = state;
+	_stateTime = millis();
+}
 void CRC_AudioManagerClass::reset() {
+	_queueCount = 0;
+	endTrack();
 	digitalWrite(crcHardware.pinAmpEnable, LOW);
 	_ampEnabled = false;
-	digitalWrite(crcHardware.vs1053_reset, LOW);
-	delay(100);
-	digitalWrite(crcHardware.vs1053_reset, HIGH);
 	digitalWrite(crcHardware.vs1053_cs, HIGH);
 	digitalWrite(crcHardware.vs1053_dcs, HIGH);
-	delay(100);
-	softReset();
-	delay(100);
-
-	sciWrite(VS1053_REG_CLOCKF, 0x6000);
+	digitalWrite(crcHardware.vs1053_reset, LOW);
+	setState(AUDIO_RESET);
 }
-void CRC_AudioManagerClass::softReset(void) {
+void CRC_AudioManagerClass::beginSoftReset() {
+	endTrack();
+	// SCI has to run below CLKI/7 until the clock multiplier is set
+	crcSpiBus.setClock(CRC_SpiBus::SPI_VS1053_CONTROL, VS1053_SCI_SLOW_HZ);
 	sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_RESET);
-	delay(100);
+	setState(AUDIO_SOFT_RESET);
+}
+void CRC_AudioManagerClass::finishReset() {
+	sciWrite(VS1053_REG_CLOCKF, 0x6000);
+	crcSpiBus.setClock(CRC_SpiBus::SPI_VS1053_CONTROL, VS1053_SCI_FAST_HZ);
+	uint8_t vs1053begin = (sciRead(VS1053_REG_STATUS) >> 4) & 0x0F;
+
+	// Dump on init
+	// dumpRegs();
+	if (vs1053begin != 4) {
+		_queueCount = 0;
+		setState(AUDIO_OFF);
+		hardwareState.audioPlayer = false;
+		crcLogger.log(crcLogger.LOG_ERROR, F("Audio chip not detected."));
+		return;
+	}
+	sciWrite(VS1053_REG_VOLUME, _volume);
+	setState(AUDIO_IDLE);
+	if (!hardwareState.audioPlayer) {
+		// DREQ edges feed the codec, the mask bit is only set while a track plays.
+		PCMSK0 &= ~VS1053_DREQ_PCMASK;
+		PCICR |= _BV(PCIE0);
+		hardwareState.audioPlayer = true;
+		crcLogger.log(crcLogger.LOG_INFO, F("Audio initialized."));
+	}
 }
 void CRC_AudioManagerClass::stopAudio() {
-	if (!_isPlayingAudio) {
+	_queueCount = 0;
+	if (!isPlayingAudio()) {
 		return;
 	}
 
-	// cancel all playback
-	sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_CANCEL);
+	cancelPlayback();
 
 	// Turn off amp
 	digitalWrite(crcHardware.pinAmpEnable, LOW);
 	_ampEnabled = false;
+}
+void CRC_AudioManagerClass::readEndFillByte() {
+	crcSpiBus.beginTransaction(CRC_SpiBus::SPI_VS1053_CONTROL);
+	sciWrite(VS1053_REG_WRAMADDR, VS1053_PARAM_END_FILL_BYTE);
+	_endFillByte = sciRead(VS1053_REG_WRAM) & 0xFF;
+	crcSpiBus.endTransaction();
+	_fillChunks = 0;
+}
+void CRC_AudioManagerClass::beginCancel(boolean flush) {
+	sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_CANCEL);
+	_fillChunks = 0;
+	_flushAfterCancel = flush;
+	setState(AUDIO_CANCELLING);
+}
+void CRC_AudioManagerClass::cancelPlayback() {
+	switch (_state) {
+	case AUDIO_STARTING:
+		// Nothing has reached the codec yet
+		endTrack();
+		setState(AUDIO_IDLE);
+		break;
+	case AUDIO_PLAYING:
+		// Stop feeding before the cancel goes out
+		endTrack();
+		readEndFillByte();
+		beginCancel(true);
+		break;
+	case AUDIO_FINISHING:
+		// Short of the 2052 endFillBytes, so flush again once the cancel clears
+		beginCancel(true);
+		break;
+	default:
+		break;
+	}
+}
+void CRC_AudioManagerClass::sendEndFill() {
+	// Datasheet end of track: 2052 endFillBytes, then set SM_CANCEL and keep
+	// sending them in 32 byte chunks until the codec clears it. Soft reset if
+	// it never does, or stops asking for data.
+	// Cancelling mid track the datasheet keeps sending the file while SM_CANCEL
+	// is set. The file is closed at once here and endFillBytes stand in for it,
+	// then as the datasheet asks the endFillByte is read again and 2052 of them
+	// sent once SM_CANCEL clears.
+	unsigned long start = micros();
+	while (readyForAudioData() && micros() - start < crcHardware.audioFeedBudgetMicros) {
+		crcSpiBus.beginTransaction(CRC_SpiBus::SPI_VS1053_DATA);
+		crcSpiBus.select();
+		for (uint8_t i = 0; i < VS1053_DATABUFFERLEN; i++) {
+			crcSpiBus.transfer(_endFillByte);
+		}
+		crcSpiBus.deselect();
+		crcSpiBus.endTransaction();
+		_fillChunks++;
+		_stateTime = millis();
 
-	// Close the Current State
+		if (_state == AUDIO_FINISHING) {
+			if (_fillChunks >= VS1053_FINISH_CHUNKS) {
+				beginCancel(false);
+			}
+		}
+		else if (_state == AUDIO_FLUSHING) {
+			if (_fillChunks >= VS1053_FINISH_CHUNKS) {
+				setState(AUDIO_IDLE);
+				return;
+			}
+		}
+		else if (!(sciRead(VS1053_REG_MODE) & VS1053_MODE_SM_CANCEL)) {
+			if (!_flushAfterCancel) {
+				setState(AUDIO_IDLE);
+				return;
+			}
+			readEndFillByte();
+			setState(AUDIO_FLUSHING);
+		}
+		else if (_fillChunks >= VS1053_CANCEL_CHUNKS) {
+			break;
+		}
+	}
+	if ((_state == AUDIO_CANCELLING && _fillChunks >= VS1053_CANCEL_CHUNKS)
+		|| millis() - _stateTime > VS1053_FILL_TIMEOUT_MS) {
+		cancelResets++;
+		beginSoftReset();
+	}
+}
+void CRC_AudioManagerClass::endTrack() {
 	_isPlayingAudio = false;
-	//currentTrack.close();
+	noInterrupts();
+	PCMSK0 &= ~VS1053_DREQ_PCMASK;
+	TIMSK0 &= ~_BV(OCIE0B);
+	interrupts();
+	if (_currentTrack.isOpen()) {
+		crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+		_currentTrack.close();
+		crcSpiBus.release();
+	}
+	_streamBlock = 0;
+	_lastAudioFeedTime = millis();
 }
 void CRC_AudioManagerClass::spiwrite(uint8_t c) {
-	SPI.transfer(c);
+	crcSpiBus.transfer(c);
 }
 void CRC_AudioManagerClass::sciWrite(uint8_t addr, uint16_t data) {
-	SPI.beginTransaction(VS1053_CONTROL_SPI_SETTING);
-	digitalWrite(crcHardware.vs1053_cs, LOW);
+	// Joins the caller's control transaction if there is one
+	crcSpiBus.beginTransaction(CRC_SpiBus::SPI_VS1053_CONTROL);
+	crcSpiBus.select();
 	spiwrite(VS1053_SCI_WRITE);
 	spiwrite(addr);
 	spiwrite(data >> 8);
 	spiwrite(data & 0xFF);
-	digitalWrite(crcHardware.vs1053_cs, HIGH);
-	SPI.endTransaction();
+	crcSpiBus.deselect();
+	crcSpiBus.endTransaction();
 }
 uint16_t CRC_AudioManagerClass::sciRead(uint8_t addr) {
 	uint16_t data;
-	SPI.beginTransaction(VS1053_CONTROL_SPI_SETTING);
-	digitalWrite(crcHardware.vs1053_cs, LOW);
+	crcSpiBus.beginTransaction(CRC_SpiBus::SPI_VS1053_CONTROL);
+	crcSpiBus.select();
 	spiwrite(VS1053_SCI_READ);
 	spiwrite(addr);
 	delayMicroseconds(10);
 	data = spiread();
 	data <<= 8;
 	data |= spiread();
-	digitalWrite(crcHardware.vs1053_cs, HIGH);
-	SPI.endTransaction();
+	crcSpiBus.deselect();
+	crcSpiBus.endTransaction();
 
 	return data;
 }
 uint8_t CRC_AudioManagerClass::spiread(void) {
-	return SPI.transfer(0x00);
+	return crcSpiBus.transfer(0x00);
 }
-boolean CRC_AudioManagerClass::startAudioFile(const char * fileName) {
+boolean CRC_AudioManagerClass::prepareTrack() {
+	if (_state < AUDIO_IDLE) {
+		// Still resetting, or no codec
+		return false;
+	}
+	// drop the current track if any
+	endTrack();
+	crcSpiBus.beginTransaction(CRC_SpiBus::SPI_VS1053_CONTROL);
 	// reset current playback if any
 	sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW);
 	// resync
 	sciWrite(VS1053_REG_WRAMADDR, 0x1e29);
 	sciWrite(VS1053_REG_WRAM, 0);
-	_currentTrack = SD.open(fileName);
-
-	if (!_currentTrack) {
-		Serial.print(fileName);
-		Serial.println(F(": "));
-		Serial.println(F("File not found, or filename over character length of 8+3."));
-		_isPlayingAudio = false;
+	crcSpiBus.endTransaction();
+	setState(AUDIO_IDLE);
+	return true;
+}
+boolean CRC_AudioManagerClass::startAudioFile(const char * fileName) {
+	if (!prepareTrack()) {
 		return false;
 	}
-
-	// As explained in datasheet, set twice 0 in REG_DECODETIME to set time back to 0
-	sciWrite(VS1053_REG_DECODETIME, 0x00);
-	sciWrite(VS1053_REG_DECODETIME, 0x00);
-	_isPlayingAudio = true;
-	enableAmp();
-
-	// wait till its ready for data
-	while (!readyForAudioData());
-
-	// fill it up!
-	while (_isPlayingAudio && readyForAudioData()) {
-		feedAudioBuffer();
+	if (!catalog.openPath(fileName, _currentTrack)) {
+		crcLogger.logF(crcLogger.LOG_WARN, F("%s: File not found, or filename over character length of 8+3."), fileName);
+		return false;
 	}
+	startTrack();
 	return true;
 }
-boolean CRC_AudioManagerClass::playFullAudioFile(const char *trackname) {
-	if (!startAudioFile(trackname)) {
+boolean CRC_AudioManagerClass::startClip(uint8_t clip) {
+	if (!prepareTrack()) {
 		return false;
 	}
-	while (_isPlayingAudio) {
-		feedAudioBuffer();
+	if (catalog.clipBlock(clip) != 0) {
+		// Packed, read consecutive blocks by address with no FAT in the way
+		_streamBlock = catalog.clipBlock(clip);
+		_streamRemaining = catalog.clipSize(clip);
+	}
+	else if (!catalog.openClip(clip, _currentTrack)) {
+		crcLogger.logF(crcLogger.LOG_WARN, F("Audio clip %u would not open."), clip);
+		return false;
 	}
-	// music file finished!
+	uint8_t category = catalog.clipCategory(clip);
+	startTrack(clip, cache.lookup(category, clip));
+	// Played, or passed over for another clip. Either way prefetch() loads the next one.
+	cache.release(category);
 	return true;
 }
+void CRC_AudioManagerClass::prefetch() {
+#if AUDIO_CACHE_BLOCKS > 0
+	// Idle, so the SD bus is ours. One category per tick keeps the loop moving.
+	if (_state != AUDIO_IDLE || _queueCount > 0 || !catalog.ready()) {
+		return;
+	}
+	for (uint8_t category = 0; category < CRC_AudioCatalog::AUDIO_CATEGORY_COUNT; category++) {
+		if (!cache.empty(category) || catalog.clipCount(category) == 0) {
+			continue;
+		}
+		crcHardware.seedRandomGenerator();
+		uint8_t clip = catalog.randomClip(category);
+		uint8_t * buffer = cache.reserve(category, clip);
+		uint16_t length = min(catalog.clipSize(clip), (uint32_t)AUDIO_CACHE_LEN);
+		boolean loaded = true;
+		crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+		if (catalog.clipBlock(clip) != 0) {
+			for (uint8_t block = 0; loaded && block * AUDIO_CACHE_BLOCK_LEN < length; block++) {
+				loaded = catalog.readBlock(catalog.clipBlock(clip) + block, buffer + block * AUDIO_CACHE_BLOCK_LEN);
+			}
+		}
+		else {
+			SdFile file;
+			loaded = catalog.openClip(clip, file) && file.read(buffer, length) == (int16_t)length;
+			file.close();
+		}
+		crcSpiBus.release(length);
+		// A failed load leaves the slot tagged but empty, it is tried again once the category plays.
+		if (loaded) {
+			cache.loaded(category, length);
+		}
+		return;
+	}
+#endif
+}
+#if AUDIO_CACHE_BLOCKS > 0
+void CRC_AudioManagerClass::loadCachedBlocks(uint8_t clip, int8_t slot) {
+	// Start from SRAM and pick the file up after the cached blocks
+	uint16_t cached = cache.length(slot);
+	const uint8_t * data = cache.data(slot);
+	for (uint16_t offset = 0; offset < cached; offset += AUDIO_SECTOR_LEN) {
+		uint16_t length = min((uint16_t)(cached - offset), (uint16_t)AUDIO_SECTOR_LEN);
+		memcpy(_sectors[_fillSector], data + offset, length);
+		_sectorLength[_fillSector] = length;
+		_fillSector ^= 1;
+		_blocksRead++;
+	}
+	if (cached >= catalog.clipSize(clip)) {
+		_endOfTrack = true;
+	}
+	else if (_streamBlock != 0) {
+		// Only whole blocks are cached short of the end of the clip
+		_streamBlock += cached / AUDIO_SECTOR_LEN;
+		_streamRemaining -= cached;
+	}
+	else {
+		crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+		_currentTrack.seekSet(cached);
+		crcSpiBus.release();
+	}
+}
+#endif
+void CRC_AudioManagerClass::startTrack(uint8_t clip, int8_t cacheSlot) {
+	// As explained in datasheet, set twice 0 in REG_DECODETIME to set time back to 0
+	crcSpiBus.beginTransaction(CRC_SpiBus::SPI_VS1053_CONTROL);
+	sciWrite(VS1053_REG_DECODETIME, 0x00);
+	sciWrite(VS1053_REG_DECODETIME, 0x00);
+	crcSpiBus.endTransaction();
+	resetSectors();
+#if AUDIO_CACHE_BLOCKS > 0
+	if (cacheSlot != CRC_AudioCache::NO_SLOT) {
+		loadCachedBlocks(clip, cacheSlot);
+	}
+#endif
+	enableAmp();
+	// tick() reads whatever the cache did not, then arms the feeder
+	setState(AUDIO_STARTING);
+}
+void CRC_AudioManagerClass::armTrack() {
+	_isPlayingAudio = true;
+	setState(AUDIO_PLAYING);
+	noInterrupts();
+	PCMSK0 |= VS1053_DREQ_PCMASK;
+	interrupts();
+	// If the codec is already asking there is no edge coming, so feed once by hand.
+	feedAudioBuffer(crcHardware.audioFeedBudgetMicros);
+}
 boolean CRC_AudioManagerClass::readyForAudioData() {
-	return digitalRead(crcHardware.vs1053_dreq);
+	return CRC_FastPin<CRC_HardwareClass::vs1053_dreq>::read();
+}
+void CRC_AudioManagerClass::resetSectors() {
+	_sectorLength[0] = _sectorLength[1] = 0;
+	_drainOffset = 0;
+	_drainSector = 0;
+	_fillSector = 0;
+	_blocksRead = 0;
+	_endOfTrack = false;
+}
+boolean CRC_AudioManagerClass::sectorsEmpty() {
+	noInterrupts();
+	boolean empty = _sectorLength[0] == 0 && _sectorLength[1] == 0;
+	interrupts();
+	return empty;
 }
-void CRC_AudioManagerClass::feedAudioBuffer() {
-	static boolean running = false;
+void CRC_AudioManagerClass::fillSector() {
+	if ((_state != AUDIO_STARTING && _state != AUDIO_PLAYING) || _endOfTrack) {
+		return;
+	}
+	noInterrupts();
+	boolean free = _sectorLength[_fillSector] == 0;
+	interrupts();
+	if (!free) {
+		return;
+	}
 
-	if (!_isPlayingAudio || running) {
+	crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+	int16_t bytesRead = readTrackBlock(_sectors[_fillSector]);
+	if (bytesRead > 0) {
+		_blocksRead++;
+		noInterrupts();
+		_sectorLength[_fillSector] = bytesRead;
+		interrupts();
+		_fillSector ^= 1;
+	}
+	if (bytesRead < AUDIO_SECTOR_LEN) {
+		// must be at the end of the file, let the feeder drain what is left
+		_endOfTrack = true;
+	}
+	crcSpiBus.release(max(bytesRead, (int16_t)0));
+}
+int16_t CRC_AudioManagerClass::readTrackBlock(uint8_t * buffer) {
+	if (_streamBlock == 0) {
+		// Reads stay block aligned, so SdFile copies straight from the card
+		// into the sector instead of going through the volume cache.
+		return _currentTrack.read(buffer, AUDIO_SECTOR_LEN);
+	}
+	if (_streamRemaining == 0) {
+		return 0;
+	}
+	if (!catalog.readBlock(_streamBlock, buffer)) {
+		return -1;
+	}
+	_streamBlock++;
+	uint16_t length = min(_streamRemaining, (uint32_t)AUDIO_SECTOR_LEN);
+	_streamRemaining -= length;
+	return length;
+}
+void CRC_AudioManagerClass::onDataRequest() {
+	if (!readyForAudioData()) {
 		return;
 	}
-	running = true;
-	if (!_isPlayingAudio) {
-		running = false;
-		return; // paused or stopped
+	// Mask ourselves and let the encoders and timers back in while the
+	// data is clocked out.
+	PCMSK0 &= ~VS1053_DREQ_PCMASK;
+	interrupts();
+	feedAudioBuffer(crcHardware.audioFeedBudgetMicros);
+	noInterrupts();
+	if (_isPlayingAudio) {
+		PCMSK0 |= VS1053_DREQ_PCMASK;
 	}
-	if (!_currentTrack) {
-		running = false;
+}
+void CRC_AudioManagerClass::feedAudioBuffer(uint16_t budgetMicros) {
+	if (!_isPlayingAudio) {
 		return;
 	}
-	if (!readyForAudioData()) {
-		running = false;
+	if (!crcSpiBus.tryBeginTransaction(CRC_SpiBus::SPI_VS1053_DATA)) {
+		// SD or control traffic on the bus, we are called again on release
 		return;
 	}
 
-	// Feed the hungry buffer! :)
+	// Bounded so a fast codec can not hold the interrupt or the loop for long,
+	// the refeed timer picks up where the budget ran out.
+	unsigned long start = micros();
+	unsigned long elapsed = 0;
+	boolean sent = false;
 	while (readyForAudioData()) {
-		//UDR0 = '.';
-		// Read some audio data from the SD card file
-		int bytesread = _currentTrack.read(_mp3buffer, VS1053_DATABUFFERLEN);
+		if (sent && elapsed >= budgetMicros) {
+			budgetCutoffs++;
+			scheduleRefeed();
+			break;
+		}
+		uint8_t sector = _drainSector;
+		uint16_t length = _sectorLength[sector];
+		if (length == 0) {
+			if (!_endOfTrack) {
+				underruns++;
+			}
+			break;
+		}
+		uint16_t offset = _drainOffset;
+		uint8_t chunk = min((uint16_t)(length - offset), (uint16_t)VS1053_DATABUFFERLEN);
+		playAudioData(&_sectors[sector][offset], chunk);
+		offset += chunk;
+		if (offset >= length) {
+			// Hand the sector back to the main loop
+			offset = 0;
+			_sectorLength[sector] = 0;
+			_drainSector = sector ^ 1;
+		}
+		_drainOffset = offset;
+		sent = true;
+		elapsed = micros() - start;
+	}
+	crcSpiBus.endTransaction();
 
-		if (bytesread == 0) {
-			// must be at the end of the file, wrap it up!
-			_isPlayingAudio = false;
-			_currentTrack.close();
-			running = false;
-			return;
+	if (sent) {
+		feeds++;
+		if (elapsed > longestFeedMicros) {
+			longestFeedMicros = min(elapsed, 0xFFFFUL);
 		}
-		playAudioData(_mp3buffer, bytesread);
-		_lastAudioFeedTime = millis();
 	}
-	running = false;
-	return;
 }
-void CRC_AudioManagerClass::playAudioData(uint8_t *buffer, uint8_t buffsiz) {
-	SPI.beginTransaction(VS1053_DATA_SPI_SETTING);
-	digitalWrite(crcHardware.vs1053_dcs, LOW);
-	for (uint8_t i = 0; i < buffsiz; i++) {
-		spiwrite(buffer[i]);
-	}
-	digitalWrite(crcHardware.vs1053_dcs, HIGH);
-	SPI.endTransaction();
+void CRC_AudioManagerClass::scheduleRefeed() {
+	uint8_t oldSREG = SREG;
+	noInterrupts();
+	OCR0B = TCNT0 + VS1053_REFEED_TICKS;
+	TIFR0 = _BV(OCF0B);		// Clear a stale match before enabling
+	TIMSK0 |= _BV(OCIE0B);
+	SREG = oldSREG;
+}
+void CRC_AudioManagerClass::playAudioData(uint8_t *buffer, uint8_t length) {
+	crcSpiBus.select();
+	// Block transfer, the sector is not needed again so the bytes read back
+	// may overwrite it.
+	crcSpiBus.transfer(buffer, length);
+	crcSpiBus.deselect();
 }
 void CRC_AudioManagerClass::enableAmp() {
 	digitalWrite(crcHardware.pinAmpEnable, HIGH);
@@ -248,26 +583,52 @@ void CRC_AudioManagerClass::disableAmp() {
 	digitalWrite(crcHardware.pinAmpEnable, LOW);
 	_ampEnabled = false;
 }
-void CRC_AudioManagerClass::playRandomAudio(String fileBase, int fileCount, String fileSuffix) {
-	if (!isPlayingAudio()) {
-		crcHardware.seedRandomGenerator();
-		int randomFile = random(1, fileCount + 1);
-		String fileNumber = formatLeadingZero(randomFile);
-		String filename = fileBase + fileNumber + fileSuffix;
-		//Serial.print("Playing: ");
-		//Serial.println(filename);
-		crcAudio.startAudioFile(filename.c_str());
+boolean CRC_AudioManagerClass::post(uint8_t category, uint8_t priority, uint8_t policy) {
+	if (_state == AUDIO_OFF || (policy == AUDIO_DROP && (_state != AUDIO_IDLE || _queueCount > 0))) {
+		droppedRequests++;
+		return false;
 	}
+	if (!enqueue(category, priority)) {
+		return false;
+	}
+	if (policy == AUDIO_PREEMPT && isPlayingAudio() && priority > _currentPriority) {
+		cancelPlayback();
+	}
+	dispatch();
+	return true;
 }
-String CRC_AudioManagerClass::formatLeadingZero(int value) {
-	String retVal;
-	if (value < 10) {
-		retVal = "0" + String(value);
+boolean CRC_AudioManagerClass::enqueue(uint8_t category, uint8_t priority) {
+	if (_queueCount == AUDIO_QUEUE_LEN) {
+		// Full, push out the newest of the lowest priority if we outrank it
+		if (_queue[AUDIO_QUEUE_LEN - 1].priority >= priority) {
+			droppedRequests++;
+			return false;
+		}
+		_queueCount--;
+		droppedRequests++;
 	}
-	else {
-		retVal = String(value);
+	uint8_t position = _queueCount;
+	while (position > 0 && _queue[position - 1].priority < priority) {
+		_queue[position] = _queue[position - 1];
+		position--;
+	}
+	_queue[position].category = category;
+	_queue[position].priority = priority;
+	_queueCount++;
+	return true;
+}
+void CRC_AudioManagerClass::dispatch() {
+	while (_state == AUDIO_IDLE && _queueCount > 0) {
+		AUDIO_REQUEST request = _queue[0];
+		_queueCount--;
+		memmove(&_queue[0], &_queue[1], _queueCount * sizeof(AUDIO_REQUEST));
+
+		crcHardware.seedRandomGenerator();
+		uint8_t clip = catalog.randomClip(request.category, cache.clip(request.category));
+		if (clip != CRC_AudioCatalog::NO_CLIP && startClip(clip)) {
+			_currentPriority = request.priority;
+		}
 	}
-	return retVal;
 }
 // 0 = lowest volume, 3 = highest volume
 void CRC_AudioManagerClass::setAmpGain(uint8_t level) {
@@ -301,11 +662,73 @@ void CRC_AudioManagerClass::setVolume(uint8_t left, uint8_t right) {
 	v <<= 8;
 	v |= right;
 
-	sciWrite(VS1053_REG_VOLUME, v);
+	// Held until the codec is out of reset
+	_volume = v;
+	if (_state >= AUDIO_IDLE) {
+		sciWrite(VS1053_REG_VOLUME, v);
+	}
 }
 void CRC_AudioManagerClass::tick() {
-	feedAudioBuffer();
-	if (!_isPlayingAudio && _ampEnabled && ((millis() - _lastAudioFeedTime) > 2000)) {
+	unsigned long elapsed = millis() - _stateTime;
+	switch (_state) {
+	case AUDIO_RESET:
+		if (elapsed >= VS1053_RESET_MS) {
+			digitalWrite(crcHardware.vs1053_reset, HIGH);
+			setState(AUDIO_BOOTING);
+		}
+		break;
+	case AUDIO_BOOTING:
+		if (readyForAudioData() || elapsed >= VS1053_BOOT_TIMEOUT_MS) {
+			beginSoftReset();
+		}
+		break;
+	case AUDIO_SOFT_RESET:
+		// DREQ drops while the reset runs, give it a moment to go low first
+		if ((readyForAudioData() && elapsed >= 2) || elapsed >= VS1053_BOOT_TIMEOUT_MS) {
+			finishReset();
+		}
+		break;
+	case AUDIO_STARTING:
+		fillSector();
+		if (_sectorLength[_drainSector] != 0 || _endOfTrack) {
+			armTrack();
+		}
+		break;
+	case AUDIO_PLAYING:
+		fillSector();
+		feedAudioBuffer(crcHardware.audioFeedBudgetMicros);
+		if (_endOfTrack && sectorsEmpty()) {
+			endTrack();
+			readEndFillByte();
+			setState(AUDIO_FINISHING);
+		}
+		break;
+	case AUDIO_FINISHING:
+	case AUDIO_CANCELLING:
+	case AUDIO_FLUSHING:
+		sendEndFill();
+		break;
+	default:
+		break;
+	}
+	dispatch();
+	prefetch();
+
+	unsigned long now = millis();
+	if (now - _statsWindowStart >= 1000) {
+		_statsWindowStart = now;
+		if (_state == AUDIO_PLAYING) {
+			noInterrupts();
+			unsigned long fed = feeds;
+			unsigned long cutoffs = budgetCutoffs;
+			unsigned long starved = underruns;
+			uint16_t longest = longestFeedMicros;
+			interrupts();
+			crcLogger.logF(crcLogger.LOG_TRACE, F("Audio feeds %lu, cut short %lu, starved %lu, longest %u us, cache hits %u/1000"),
+				fed, cutoffs, starved, longest, cache.hitRate());
+		}
+	}
+	if (!isPlayingAudio() && _ampEnabled && ((millis() - _lastAudioFeedTime) > 2000)) {
 		disableAmp();
 	}
 }
@@ -23,40 +23,135 @@ See README.md for license details
 #endif
 
 #include <SD.h>
+#include "CRC_AudioCatalog.h"
+#include "CRC_AudioCache.h"
 
 #define VS1053_DATABUFFERLEN 32
+#define AUDIO_SECTOR_LEN	512		// One SD block per buffer
+#define AUDIO_QUEUE_LEN		4		// Pending sound requests
 
 class CRC_AudioManagerClass {
 private:
-	boolean _isPlayingAudio;
+	// Codec states, each step is advanced by tick() so nothing waits on the codec.
+	enum AUDIO_STATE : uint8_t {
+		AUDIO_OFF,			// Chip not detected
+		AUDIO_RESET,		// Hardware reset pulse
+		AUDIO_BOOTING,		// Waiting for the chip to come out of reset
+		AUDIO_SOFT_RESET,	// Waiting for SM_RESET to finish
+		AUDIO_IDLE,
+		AUDIO_STARTING,		// Track open, reading its first sector
+		AUDIO_PLAYING,
+		AUDIO_FINISHING,	// Whole track sent, flushing the decoder with endFillByte
+		AUDIO_CANCELLING,	// SM_CANCEL set, endFillByte until the codec clears it
+		AUDIO_FLUSHING		// Cancel cleared mid track, 2052 endFillBytes before idle
+	};
+	AUDIO_STATE _state;
+	unsigned long _stateTime;		// millis() the state was entered or last made progress
+	uint8_t _endFillByte;
+	uint8_t _fillChunks;			// endFillByte chunks sent in this state
+	boolean _flushAfterCancel;		// Cancel cut a track short, flush once SM_CANCEL clears
+	uint16_t _volume;				// Written again after every reset
+	volatile boolean _isPlayingAudio;	// Feeder may send track data
 	boolean _ampEnabled;
-	uint8_t _mp3buffer[VS1053_DATABUFFERLEN];
-	File    _currentTrack;
-	long    _lastAudioFeedTime;
+	SdFile  _currentTrack;
+	uint32_t _streamBlock;			// Next card block of a packed clip, 0 when reading _currentTrack
+	uint32_t _streamRemaining;		// Bytes of the packed clip not yet read
+	unsigned long _lastAudioFeedTime;
 
-	void feedAudioBuffer();
+	// Double buffered SD blocks. tick() reads a whole block into an empty
+	// sector, the DREQ interrupt drains full ones in 32 byte chunks.
+	// A sector with length 0 belongs to the main loop, otherwise to the feeder.
+	uint8_t _sectors[2][AUDIO_SECTOR_LEN];
+	volatile uint16_t _sectorLength[2];
+	volatile uint16_t _drainOffset;	// Next byte to send from the draining sector
+	volatile uint8_t _drainSector;
+	uint8_t _fillSector;
+	volatile boolean _endOfTrack;	// Whole file has been read
+	uint8_t _blocksRead;			// Blocks of the track read or taken from the cache
+
+	// Pending requests, highest priority first, first come first within a priority.
+	struct AUDIO_REQUEST {
+		uint8_t category;
+		uint8_t priority;
+	};
+	AUDIO_REQUEST _queue[AUDIO_QUEUE_LEN];
+	uint8_t _queueCount;
+	uint8_t _currentPriority;
+	unsigned long _statsWindowStart;
+
+	void resetSectors();
+	boolean sectorsEmpty();
+	void fillSector();
+	int16_t readTrackBlock(uint8_t * buffer);
+	void setState(AUDIO_STATE state);
+	void endTrack();
+	boolean prepareTrack();
+	void armTrack();
+	void startTrack(uint8_t clip = CRC_AudioCatalog::NO_CLIP, int8_t cacheSlot = CRC_AudioCache::NO_SLOT);
+	void loadCachedBlocks(uint8_t clip, int8_t slot);
 	boolean readyForAudioData();
-	void playAudioData(uint8_t *buffer, uint8_t buffsiz);
+	void playAudioData(uint8_t *buffer, uint8_t length);
+	void scheduleRefeed();
 	void sciWrite(uint8_t addr, uint16_t data);
 	void spiwrite(uint8_t c);
 	uint16_t sciRead(uint8_t addr);
 	uint8_t spiread(void);
 	void dumpRegs(void);
-	void softReset();
+	void beginSoftReset();
+	void finishReset();
+	void readEndFillByte();
+	void beginCancel(boolean flush);
+	void sendEndFill();
+	boolean enqueue(uint8_t category, uint8_t priority);
+	void dispatch();
+	void prefetch();
+	void cancelPlayback();
 public:
-	boolean init();
+	static const uint8_t AUDIO_PRIORITY_LOW = 0;		// Idle chatter
+	static const uint8_t AUDIO_PRIORITY_NORMAL = 1;		// Reactions
+	static const uint8_t AUDIO_PRIORITY_HIGH = 2;		// Warnings the user must hear
+
+	static const uint8_t AUDIO_DROP = 0;		// Only play if nothing is playing or waiting
+	static const uint8_t AUDIO_ENQUEUE = 1;		// Play once everything ahead of it is done
+	static const uint8_t AUDIO_PREEMPT = 2;		// Cut off anything of lower priority
+
+	CRC_AudioCatalog catalog;
+	CRC_AudioCache cache;
+
+	// Starts the codec reset, tick() finishes it and sets hardwareState.audioPlayer.
+	void init();
+	// Called from the DREQ pin change interrupt.
+	void onDataRequest();
+	// Top up the codec from the sectors for at most budgetMicros, at least one
+	// chunk is always sent. Safe from the loop or the interrupt, if the SPI bus
+	// is held it runs again when the bus is released.
+	void feedAudioBuffer(uint16_t budgetMicros);
 	void reset();
-	inline boolean isPlayingAudio() { return _isPlayingAudio; }
+	// Starting, playing or winding down a track
+	inline boolean isPlayingAudio() { return _state > AUDIO_IDLE; }
 	void stopAudio();
+	// Open a track and return, tick() reads and starts it. False if the codec
+	// is still resetting or the file would not open.
 	boolean startAudioFile(const char *fileName);
-	boolean playFullAudioFile(const char *trackname);
+	boolean startClip(uint8_t clip);
 	void enableAmp();
 	void disableAmp();
 	void setAmpGain(uint8_t level);
 	void setVolume(uint8_t left, uint8_t right);
-	String formatLeadingZero(int value);
-	void playRandomAudio(String fileBase, int fileCount, String fileSuffix);
+	// Ask for a random clip from a CRC_AudioCatalog::AUDIO_CATEGORY. Never
+	// blocks on the current clip, returns false if the request was dropped.
+	boolean post(uint8_t category, uint8_t priority, uint8_t policy);
+	// Play any clip from a category, unless already playing.
+	inline void playRandomAudio(uint8_t category) { post(category, AUDIO_PRIORITY_NORMAL, AUDIO_DROP); }
 	void tick();
+
+	// Diagnostics
+	volatile unsigned long feeds;			// Feeds that sent at least one chunk
+	volatile unsigned long budgetCutoffs;	// Feeds stopped by the budget with DREQ still high
+	volatile unsigned long underruns;		// Codec asked for data and no sector was ready
+	volatile uint16_t longestFeedMicros;
+	unsigned long droppedRequests;		// Posts refused or pushed out of the queue
+	unsigned long cancelResets;			// Cancels the codec did not finish, soft reset instead
 };
 extern CRC_AudioManagerClass crcAudio;
 
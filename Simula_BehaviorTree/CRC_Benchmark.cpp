@@ -0,0 +1,231 @@
+/***************************************************
+Uses: Boot time micro benchmarks for the hot paths. Results
+are logged in CPU cycles per call.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_Benchmark.h"
+#include "CRC_Orientation.h"
+#include "CRC_Hardware.h"
+#include "CRC_FastGpio.h"
+#include "CRC_Motor.h"
+#include "CRC_StopWatch.h"
+#include "CRC_Logger.h"
+#include "CRC_AudioManager.h"
+#include "CRC_SpiBus.h"
+#include "CRC_Lights.h"
+#include <SD.h>
+
+#define BENCHMARK_ITERATIONS	1000
+#define BENCHMARK_AUDIO_BLOCKS	64		// 32 KB, a few seconds of a clip
+#define BENCHMARK_LIGHT_FRAMES	20
+
+void CRC_BenchmarkClass::run() {
+	crcLogger.log(crcLogger.LOG_INFO, F("Running benchmarks."));
+	benchmarkOrientation();
+	benchmarkGpio();
+	benchmarkEncoder();
+	benchmarkAudioRead();
+	benchmarkLights();
+}
+
+unsigned long CRC_BenchmarkClass::cyclesPerCall(unsigned long elapsedMicros, uint16_t iterations) {
+	return elapsedMicros * clockCyclesPerMicrosecond() / iterations;
+}
+
+void CRC_BenchmarkClass::benchmarkOrientation() {
+	CRC_Orientation orientation;
+	CRC_StopWatch timer(CRC_StopWatch::MICROS);
+	IMU_SAMPLE gyro = { 0, 120, -340, 2100 };
+	IMU_SAMPLE accel = { 0, -900, 1500, 16100 };
+
+	// One filter step at 100 Hz is a gyro integration plus an accel correction.
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		gyro.timestamp += 10000;
+		orientation.updateGyro(gyro);
+		orientation.updateAccel(accel);
+	}
+	timer.stop();
+
+	crcLogger.logF(crcLogger.LOG_INFO, F("Orientation update: %lu cycles (roll %ld)."),
+		cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS), orientation.roll());
+}
+
+void CRC_BenchmarkClass::benchmarkGpio() {
+	// Motors are stopped at boot, so rewriting "off" to the left motor pins is harmless.
+	CRC_StopWatch timer(CRC_StopWatch::MICROS);
+	CRC_CachedPwm enable(crcHardware.mtr1Enable);
+	CRC_CachedPin in1(crcHardware.mtr1In1);
+	CRC_CachedPin in2(crcHardware.mtr1In2);
+
+	// What CRC_Motor::setPower used to do on every update
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		analogWrite(crcHardware.mtr1Enable, 0);
+		digitalWrite(crcHardware.mtr1In1, LOW);
+		digitalWrite(crcHardware.mtr1In2, LOW);
+	}
+	timer.stop();
+	unsigned long arduinoCycles = cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS);
+
+	// Cached pins, value unchanged after the first pass
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		enable.write(0);
+		in1.write(LOW);
+		in2.write(LOW);
+	}
+	timer.stop();
+	unsigned long cachedCycles = cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS);
+
+	// Cached pins forced through to the port every time
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		in1.invalidate();
+		in2.invalidate();
+		in1.write(LOW);
+		in2.write(LOW);
+	}
+	timer.stop();
+	unsigned long portCycles = cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS);
+
+	// Compile time pin, a single cbi
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		CRC_FastPin<CRC_HardwareClass::pinActEdge1>::low();
+	}
+	timer.stop();
+	unsigned long fastCycles = cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS);
+
+	crcLogger.logF(crcLogger.LOG_INFO, F("Motor pin update: %lu cycles Arduino, %lu cached, %lu for two direct port writes."),
+		arduinoCycles, cachedCycles, portCycles);
+	crcLogger.logF(crcLogger.LOG_INFO, F("Fixed pin write: %lu cycles. GPIO saved per loop (2 motors): %lu cycles."),
+		fastCycles, 2 * (arduinoCycles - cachedCycles));
+}
+
+void CRC_BenchmarkClass::benchmarkEncoder() {
+	// Run the left wheel's ISR body with the stored state walked back one step each
+	// time, so every call decodes an edge and takes the timestamp path.
+	static const uint8_t previousState[4] = { 2, 0, 3, 1 };
+	CRC_Encoder * encoder = motors.motorLeft;
+	CRC_StopWatch timer(CRC_StopWatch::MICROS);
+	int32_t position = encoder->read();
+
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		noInterrupts();
+		encoder->_state = previousState[encoder->readPins()];
+		encoder->update();
+		interrupts();
+	}
+	timer.stop();
+	unsigned long edgeCycles = cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS);
+	encoder->write(position);
+
+	timer.start();
+	for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		encoder->edgeVelocity();
+	}
+	timer.stop();
+	unsigned long velocityCycles = cyclesPerCall(timer.elapsed(), BENCHMARK_ITERATIONS);
+
+	// attachInterrupt dispatch adds its register save/restore on top of the body.
+	crcLogger.logF(crcLogger.LOG_INFO, F("Encoder ISR body: %lu cycles per edge. Velocity estimate: %lu cycles."),
+		edgeCycles, velocityCycles);
+}
+
+void CRC_BenchmarkClass::benchmarkAudioRead() {
+	CRC_AudioCatalog & catalog = crcAudio.catalog;
+	if (!catalog.isPacked() || catalog.clipCount() == 0) {
+		crcLogger.log(crcLogger.LOG_INFO, F("Audio read benchmark skipped, no AUDIO.PAK."));
+		return;
+	}
+	// The same blocks of the first packed clip, once through the SD library
+	// and once by address. Worst minus best block is the jitter the feeder sees.
+	uint8_t buffer[AUDIO_SECTOR_LEN];
+	uint32_t block = catalog.clipBlock(0);
+	uint16_t blocks = min((uint32_t)BENCHMARK_AUDIO_BLOCKS, (catalog.clipSize(0) + AUDIO_SECTOR_LEN - 1) / AUDIO_SECTOR_LEN);
+	CRC_StopWatch timer(CRC_StopWatch::MICROS);
+	unsigned long fileBest = 0xFFFFFFFFUL, fileWorst = 0, fileTotal = 0;
+	unsigned long rawBest = 0xFFFFFFFFUL, rawWorst = 0, rawTotal = 0;
+
+	crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+	File pack = SD.open(AUDIO_PACK_NAME);
+	pack.seek((block - catalog.packBlock()) * AUDIO_SECTOR_LEN);
+	for (uint16_t i = 0; i < blocks; i++) {
+		timer.restart();
+		pack.read(buffer, AUDIO_SECTOR_LEN);
+		timer.stop();
+		unsigned long elapsed = timer.elapsed();
+		fileTotal += elapsed;
+		fileBest = min(fileBest, elapsed);
+		fileWorst = max(fileWorst, elapsed);
+	}
+	pack.close();
+	crcSpiBus.release(blocks * AUDIO_SECTOR_LEN);
+
+	crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+	for (uint16_t i = 0; i < blocks; i++) {
+		timer.restart();
+		catalog.readBlock(block + i, buffer);
+		timer.stop();
+		unsigned long elapsed = timer.elapsed();
+		rawTotal += elapsed;
+		rawBest = min(rawBest, elapsed);
+		rawWorst = max(rawWorst, elapsed);
+	}
+	crcSpiBus.release(blocks * AUDIO_SECTOR_LEN);
+
+	crcLogger.logF(crcLogger.LOG_INFO, F("SD.open read: %lu B/s, block %lu..%lu us. Raw block read: %lu B/s, block %lu..%lu us."),
+		(uint32_t)blocks * AUDIO_SECTOR_LEN * 1000UL / max(fileTotal / 1000UL, 1UL), fileBest, fileWorst,
+		(uint32_t)blocks * AUDIO_SECTOR_LEN * 1000UL / max(rawTotal / 1000UL, 1UL), rawBest, rawWorst);
+}
+
+void CRC_BenchmarkClass::benchmarkLights() {
+	// Alternate two dim levels so every frame really changes.
+	CRC_StopWatch timer(CRC_StopWatch::MICROS);
+
+	// Every channel in its own transaction, as setLed used to write them
+	timer.start();
+	for (uint8_t frame = 0; frame < BENCHMARK_LIGHT_FRAMES; frame++) {
+		uint8_t level = 64 + (frame & 1);
+		for (uint8_t channel = 0; channel < 15; channel++) {
+			crcLights.setLeftLed(channel, level);
+			crcLights.flush();
+			crcLights.setRightLed(channel, level);
+			crcLights.flush();
+		}
+	}
+	timer.stop();
+	unsigned long channelMicros = timer.elapsed() / BENCHMARK_LIGHT_FRAMES;
+
+	// One burst per chip
+	timer.start();
+	for (uint8_t frame = 0; frame < BENCHMARK_LIGHT_FRAMES; frame++) {
+		uint8_t level = 64 + (frame & 1);
+		crcLights.setAllLeds(level, level, level);
+		crcLights.flush();
+	}
+	timer.stop();
+	unsigned long burstMicros = timer.elapsed() / BENCHMARK_LIGHT_FRAMES;
+
+	// Same frame again, nothing to send
+	timer.start();
+	for (uint8_t frame = 0; frame < BENCHMARK_LIGHT_FRAMES; frame++) {
+		crcLights.setAllLeds(65, 65, 65);
+		crcLights.flush();
+	}
+	timer.stop();
+	unsigned long unchangedMicros = timer.elapsed() / BENCHMARK_LIGHT_FRAMES;
+	crcLights.setAllOff();
+	crcLights.flush();
+
+	crcLogger.logF(crcLogger.LOG_INFO, F("LED frame: %lu us per register, %lu us burst, %lu us unchanged."),
+		channelMicros, burstMicros, unchangedMicros);
+}
@@ -0,0 +1,38 @@
+/***************************************************
+Uses: Boot time micro benchmarks for the hot paths. Results
+are logged in CPU cycles per call.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_BENCHMARK_h
+#define _CRC_BENCHMARK_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+// Uncomment to run the benchmarks from setup() and log the results.
+//#define _CRC_BENCHMARK_
+
+class CRC_BenchmarkClass {
+private:
+	unsigned long cyclesPerCall(unsigned long elapsedMicros, uint16_t iterations);
+	void benchmarkOrientation();
+	void benchmarkGpio();
+	void benchmarkEncoder();
+	void benchmarkAudioRead();
+	void benchmarkLights();
+public:
+	void run();
+};
+
+extern CRC_BenchmarkClass crcBenchmark;
+
+#endif
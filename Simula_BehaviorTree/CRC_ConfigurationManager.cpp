@@ -15,43 +15,44 @@ See README.md for license details
 #include "CRC_ConfigurationManager.h"
 #include "CRC_Logger.h"
 #include "CRC_Hardware.h"
+#include "CRC_SpiBus.h"
 
 
 bool CRC_ConfigurationManagerClass::getConfig(const __FlashStringHelper * cfgName, char * szValue, size_t bufferSize)
 {
-	if (!initConfig())
+	// Audio feeds the codec from an interrupt, keep it off the bus while the card is busy
+	crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+	bool found = false;
+	if (initConfig())
 	{
-		return false;
-	}
-	File configFile = SD.open(F("/simula.cfg"));
-
-	if (findConfig(configFile, cfgName))
-	{
-		readValue(configFile, szValue, bufferSize);
+		File configFile = SD.open(F("/simula.cfg"));
+		found = findConfig(configFile, cfgName);
+		if (found)
+		{
+			readValue(configFile, szValue, bufferSize);
+		}
 		configFile.close();
-		return true;
 	}
-	configFile.close();
-	return false;
+	crcSpiBus.release();
+	return found;
 }
 
 bool CRC_ConfigurationManagerClass::getConfig(const char * cfgName, char * szValue, size_t bufferSize)
 {
-	if (!initConfig())
+	crcSpiBus.acquire(CRC_SpiBus::SPI_SD_CARD);
+	bool found = false;
+	if (initConfig())
 	{
-		return false;
-	}
-	File configFile = SD.open(F("/simula.cfg"));
-
-	if (findConfig(configFile, cfgName))
-	{
-		readValue(configFile, szValue, bufferSize);
+		File configFile = SD.open(F("/simula.cfg"));
+		found = findConfig(configFile, cfgName);
+		if (found)
+		{
+			readValue(configFile, szValue, bufferSize);
+		}
 		configFile.close();
-		return true;
 	}
-
-	configFile.close();
-	return false;
+	crcSpiBus.release();
+	return found;
 }
 
 
@@ -0,0 +1,62 @@
+/***************************************************
+Uses: Estimates time-to-contact for one distance channel from
+the trend of its filtered readings and the robot's own approach
+speed, in integer math.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_ContactPredictor.h"
+
+#define CONTACT_RATE_SHIFT	2	// Sensor rate smoothing, 1/4 per sample
+#define CONTACT_MAX_DT		250	// Older history is too stale to difference (millis)
+
+CRC_ContactPredictor::CRC_ContactPredictor() {
+	reset();
+}
+
+void CRC_ContactPredictor::reset() {
+	_lastMM = 0;
+	_lastMillis = 0;
+	_sensorRate = 0;
+	_closingRate = 0;
+	_ttcMillis = TTC_NONE;
+	_primed = false;
+}
+
+void CRC_ContactPredictor::update(uint8_t cm, uint8_t marginCM, unsigned long now, int16_t approachMMps) {
+	uint16_t mm = (uint16_t)cm * 10;
+	unsigned long dt = now - _lastMillis;
+
+	if (_primed && dt > 0 && dt <= CONTACT_MAX_DT) {
+		int32_t rate = ((int32_t)_lastMM - mm) * 1000 / (int32_t)dt;
+		rate = constrain(rate, -5000L, 5000L);
+		_sensorRate += ((int16_t)rate - _sensorRate) >> CONTACT_RATE_SHIFT;
+	}
+	else {
+		_sensorRate = 0;
+	}
+	_lastMM = mm;
+	_lastMillis = now;
+	_primed = true;
+
+	// The wheels give a clean rate for fixed obstacles, the sensor trend
+	// catches anything closing faster than that.
+	_closingRate = max(_sensorRate, approachMMps);
+	if (_closingRate <= 0) {
+		_ttcMillis = TTC_NONE;
+		return;
+	}
+
+	uint16_t marginMM = (uint16_t)marginCM * 10;
+	if (mm <= marginMM) {
+		_ttcMillis = 0;
+		return;
+	}
+	uint32_t ttc = (uint32_t)(mm - marginMM) * 1000 / _closingRate;
+	_ttcMillis = (ttc < TTC_NONE) ? ttc : TTC_NONE - 1;
+}
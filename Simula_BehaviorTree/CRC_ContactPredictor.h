@@ -0,0 +1,43 @@
+/***************************************************
+Uses: Estimates time-to-contact for one distance channel from
+the trend of its filtered readings and the robot's own approach
+speed, in integer math.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_CONTACTPREDICTOR_h
+#define _CRC_CONTACTPREDICTOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+class CRC_ContactPredictor {
+private:
+	uint16_t _lastMM;
+	unsigned long _lastMillis;
+	int16_t _sensorRate;	// Smoothed closing rate seen by the sensor, mm/s
+	int16_t _closingRate;	// Rate used for the prediction, mm/s
+	uint16_t _ttcMillis;
+	boolean _primed;
+public:
+	static const uint16_t TTC_NONE = 0xFFFF;
+
+	CRC_ContactPredictor();
+	void reset();
+	// cm: filtered reading, marginCM: distance that counts as contact,
+	// approachMMps: closing speed implied by the wheels for this channel.
+	void update(uint8_t cm, uint8_t marginCM, unsigned long now, int16_t approachMMps);
+	// Predicted millis until contact, TTC_NONE when not closing.
+	inline uint16_t ttcMillis() { return _ttcMillis; }
+	inline int16_t closingRate() { return _closingRate; }
+};
+
+#endif
@@ -0,0 +1,132 @@
+/***************************************************
+Uses: Interrupt driven quadrature decoder for the wheel
+encoders. Besides the position, each edge is timestamped
+with micros() into a small period buffer, so speed can be
+estimated from the time between edges instead of counting
+edges over a window.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_Encoder.h"
+#include "CRC_FastGpio.h"
+
+// Position change indexed by (new state << 2) | old state, state = pin1 | pin2 << 1.
+// Same counting direction as the Encoder library it replaces, +-2 is a missed edge.
+static const int8_t ENCODER_STEPS[16] = { 0, 1, -1, 2, -1, 0, -2, 1, 1, -2, 0, -1, 2, -1, 1, 0 };
+
+CRC_Encoder * CRC_Encoder::_instances[ENCODER_MAX_INSTANCES];
+uint8_t CRC_Encoder::_instanceCount = 0;
+
+CRC_Encoder::CRC_Encoder(uint8_t pin1, uint8_t pin2) {
+	pinMode(pin1, INPUT_PULLUP);
+	pinMode(pin2, INPUT_PULLUP);
+	// PINx sits two below PORTx
+	_pin1Register = &_SFR_MEM8(CRC_FastGpio::port(pin1) - 2);
+	_pin2Register = &_SFR_MEM8(CRC_FastGpio::port(pin2) - 2);
+	_pin1Mask = CRC_FastGpio::mask(pin1);
+	_pin2Mask = CRC_FastGpio::mask(pin2);
+
+	_position = 0;
+	_state = readPins();
+	_lastEdgeMicros = micros();
+	_periodHead = 0;
+	_periodCount = 0;
+	_direction = 0;
+
+	if (_instanceCount >= ENCODER_MAX_INSTANCES) {
+		return;
+	}
+	_instances[_instanceCount] = this;
+	void (*handler)() = (_instanceCount == 0) ? isr<0> : isr<1>;
+	_instanceCount++;
+	attachInterrupt(digitalPinToInterrupt(pin1), handler, CHANGE);
+	attachInterrupt(digitalPinToInterrupt(pin2), handler, CHANGE);
+}
+
+uint8_t CRC_Encoder::readPins() {
+	uint8_t state = 0;
+	if (*_pin1Register & _pin1Mask) {
+		state |= 1;
+	}
+	if (*_pin2Register & _pin2Mask) {
+		state |= 2;
+	}
+	return state;
+}
+
+void CRC_Encoder::update() {
+	uint8_t state = readPins();
+	int8_t step = ENCODER_STEPS[(state << 2) | _state];
+	_state = state;
+	if (step == 0) {
+		return;
+	}
+	_position += step;
+
+	unsigned long now = micros();
+	unsigned long period = now - _lastEdgeMicros;
+	_lastEdgeMicros = now;
+	int8_t direction = (step > 0) ? 1 : -1;
+	if (direction != _direction) {
+		// Reversed, older periods belong to the other direction.
+		_direction = direction;
+		_periodHead = 0;
+		_periodCount = 0;
+	}
+	if (step == 2 || step == -2) {
+		// An edge was missed, split the time over both.
+		period >>= 1;
+	}
+	_periods[_periodHead] = (period > 0xFFFF) ? 0xFFFF : period;
+	_periodHead = (_periodHead + 1) & (ENCODER_PERIOD_COUNT - 1);
+	if (_periodCount < ENCODER_PERIOD_COUNT) {
+		_periodCount++;
+	}
+}
+
+int32_t CRC_Encoder::read() {
+	noInterrupts();
+	int32_t position = _position;
+	interrupts();
+	return position;
+}
+
+void CRC_Encoder::write(int32_t position) {
+	noInterrupts();
+	_position = position;
+	interrupts();
+}
+
+int32_t CRC_Encoder::edgeVelocity() {
+	noInterrupts();
+	uint8_t count = _periodCount;
+	unsigned long lastEdge = _lastEdgeMicros;
+	int8_t direction = _direction;
+	uint32_t total = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		total += _periods[i];
+	}
+	interrupts();
+
+	if (count == 0) {
+		return 0;
+	}
+	unsigned long sinceEdge = micros() - lastEdge;
+	if (sinceEdge > ENCODER_TIMEOUT_MICROS) {
+		return 0;
+	}
+	uint32_t period = total / count;
+	if (sinceEdge > period) {
+		// Slowing down, the next edge is already late so the speed is at most this.
+		period = sinceEdge;
+	}
+	if (period == 0) {
+		period = 1;
+	}
+	return direction * (int32_t)(1000000UL / period);
+}
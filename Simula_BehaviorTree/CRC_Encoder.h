@@ -0,0 +1,61 @@
+/***************************************************
+Uses: Interrupt driven quadrature decoder for the wheel
+encoders. Besides the position, each edge is timestamped
+with micros() into a small period buffer, so speed can be
+estimated from the time between edges instead of counting
+edges over a window.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_ENCODER_h
+#define _CRC_ENCODER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#define ENCODER_MAX_INSTANCES	2		// One per wheel
+#define ENCODER_PERIOD_COUNT	4		// A full quadrature cycle, evens out A/B phase error
+#define ENCODER_TIMEOUT_MICROS	100000	// No edge for this long reads as stopped
+
+class CRC_Encoder {
+private:
+	volatile uint8_t * _pin1Register;
+	volatile uint8_t * _pin2Register;
+	uint8_t _pin1Mask;
+	uint8_t _pin2Mask;
+
+	// Shared with the ISR
+	volatile int32_t _position;
+	volatile uint8_t _state;
+	volatile unsigned long _lastEdgeMicros;
+	volatile uint16_t _periods[ENCODER_PERIOD_COUNT];	// micros between edges, saturated
+	volatile uint8_t _periodHead;
+	volatile uint8_t _periodCount;
+	volatile int8_t _direction;
+
+	static CRC_Encoder * _instances[ENCODER_MAX_INSTANCES];
+	static uint8_t _instanceCount;
+	template <uint8_t N> static void isr() { _instances[N]->update(); }
+
+	uint8_t readPins();
+	friend class CRC_BenchmarkClass;
+public:
+	// Pins must be external interrupt pins (2, 3, 18-21 on the Mega).
+	CRC_Encoder(uint8_t pin1, uint8_t pin2);
+	// ISR body, decodes one edge.
+	void update();
+	int32_t read();
+	void write(int32_t position);
+	// Pulses per second from the recent edge periods, 0 once stopped.
+	int32_t edgeVelocity();
+};
+
+#endif
@@ -0,0 +1,185 @@
+/***************************************************
+Uses: Direct port GPIO for the ATmega2560 (Mega) pinout. Pin
+numbers resolve to PORTx register and bit mask at compile time,
+so writes skip Arduino's pin lookup tables. The cached pin types
+also skip writes that would not change the output.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_FASTGPIO_h
+#define _CRC_FASTGPIO_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+// PORTx data space addresses, PINx and DDRx sit 2 and 1 below.
+#define GPIO_PORTA	0x22
+#define GPIO_PORTB	0x25
+#define GPIO_PORTC	0x28
+#define GPIO_PORTD	0x2B
+#define GPIO_PORTE	0x2E
+#define GPIO_PORTF	0x31
+#define GPIO_PORTG	0x34
+#define GPIO_PORTH	0x102
+#define GPIO_PORTJ	0x105
+#define GPIO_PORTK	0x108
+#define GPIO_PORTL	0x10B
+#define GPIO_SBI_LIMIT	0x40	// Below this sbi/cbi reach the register, so no interrupt guard
+
+class CRC_FastGpio {
+public:
+	// PORTx address for an Arduino Mega pin number, 0 if there is none.
+	static constexpr uint16_t port(uint8_t pin) {
+		return (pin <= 3 || pin == 5) ? GPIO_PORTE
+			: (pin == 4 || (pin >= 39 && pin <= 41)) ? GPIO_PORTG
+			: (pin >= 6 && pin <= 9) || pin == 16 || pin == 17 ? GPIO_PORTH
+			: (pin >= 10 && pin <= 13) || (pin >= 50 && pin <= 53) ? GPIO_PORTB
+			: (pin == 14 || pin == 15) ? GPIO_PORTJ
+			: (pin >= 18 && pin <= 21) || pin == 38 ? GPIO_PORTD
+			: (pin >= 22 && pin <= 29) ? GPIO_PORTA
+			: (pin >= 30 && pin <= 37) ? GPIO_PORTC
+			: (pin >= 42 && pin <= 49) ? GPIO_PORTL
+			: (pin >= 54 && pin <= 61) ? GPIO_PORTF
+			: (pin >= 62 && pin <= 69) ? GPIO_PORTK
+			: 0;
+	}
+	// Bit within the port for an Arduino Mega pin number.
+	static constexpr uint8_t bitOf(uint8_t pin) {
+		return (pin <= 1) ? pin
+			: (pin <= 3) ? pin + 2
+			: (pin == 4) ? 5
+			: (pin == 5) ? 3
+			: (pin <= 9) ? pin - 3
+			: (pin <= 13) ? pin - 6
+			: (pin <= 15) ? 15 - pin
+			: (pin <= 17) ? 17 - pin
+			: (pin <= 21) ? 21 - pin
+			: (pin <= 29) ? pin - 22
+			: (pin <= 37) ? 37 - pin
+			: (pin == 38) ? 7
+			: (pin <= 41) ? 41 - pin
+			: (pin <= 49) ? 49 - pin
+			: (pin <= 53) ? 53 - pin
+			: (pin <= 61) ? pin - 54
+			: pin - 62;
+	}
+	static constexpr uint8_t mask(uint8_t pin) { return 1 << bitOf(pin); }
+};
+
+// A pin fixed at compile time. Low ports compile down to a single sbi/cbi.
+template <uint8_t PIN>
+class CRC_FastPin {
+	static_assert(CRC_FastGpio::port(PIN) != 0, "Not an ATmega2560 pin");
+public:
+	static inline void setOutput() {
+		update(_SFR_MEM8(CRC_FastGpio::port(PIN) - 1), true);
+	}
+	static inline void high() {
+		update(_SFR_MEM8(CRC_FastGpio::port(PIN)), true);
+	}
+	static inline void low() {
+		update(_SFR_MEM8(CRC_FastGpio::port(PIN)), false);
+	}
+	static inline void write(boolean value) {
+		if (value) {
+			high();
+		}
+		else {
+			low();
+		}
+	}
+	static inline boolean read() {
+		return (_SFR_MEM8(CRC_FastGpio::port(PIN) - 2) & CRC_FastGpio::mask(PIN)) != 0;
+	}
+private:
+	static inline void update(volatile uint8_t & reg, boolean set) {
+		if (CRC_FastGpio::port(PIN) < GPIO_SBI_LIMIT) {
+			if (set) {
+				reg |= CRC_FastGpio::mask(PIN);
+			}
+			else {
+				reg &= ~CRC_FastGpio::mask(PIN);
+			}
+			return;
+		}
+		// Ports H and up need a read-modify-write, keep ISRs from interleaving.
+		uint8_t oldSREG = SREG;
+		cli();
+		if (set) {
+			reg |= CRC_FastGpio::mask(PIN);
+		}
+		else {
+			reg &= ~CRC_FastGpio::mask(PIN);
+		}
+		SREG = oldSREG;
+	}
+};
+
+// A digital output picked at run time (pin tables, constructor arguments),
+// resolved once. write() returns without touching the port if nothing changes.
+class CRC_CachedPin {
+private:
+	volatile uint8_t * _port;
+	uint8_t _mask;
+	uint8_t _state;		// Last written level, STATE_UNKNOWN before the first write
+public:
+	static const uint8_t STATE_UNKNOWN = 0xFF;
+
+	CRC_CachedPin() : _port(0), _mask(0), _state(STATE_UNKNOWN) {}
+	explicit CRC_CachedPin(uint8_t pin)
+		: _port(&_SFR_MEM8(CRC_FastGpio::port(pin))), _mask(CRC_FastGpio::mask(pin)), _state(STATE_UNKNOWN) {}
+
+	inline void setOutput() {
+		uint8_t oldSREG = SREG;
+		cli();
+		*(_port - 1) |= _mask;
+		SREG = oldSREG;
+	}
+	inline void write(uint8_t value) {
+		value = value ? HIGH : LOW;
+		if (value == _state) {
+			return;
+		}
+		_state = value;
+		uint8_t oldSREG = SREG;
+		cli();
+		if (value) {
+			*_port |= _mask;
+		}
+		else {
+			*_port &= ~_mask;
+		}
+		SREG = oldSREG;
+	}
+	// Forget the cached level, the next write always reaches the port.
+	inline void invalidate() { _state = STATE_UNKNOWN; }
+};
+
+// PWM output that only calls analogWrite when the duty cycle changes.
+class CRC_CachedPwm {
+private:
+	uint8_t _pin;
+	int16_t _value;		// -1 before the first write
+public:
+	CRC_CachedPwm() : _pin(0), _value(-1) {}
+	explicit CRC_CachedPwm(uint8_t pin) : _pin(pin), _value(-1) {}
+
+	inline void write(uint8_t value) {
+		if (value == _value) {
+			return;
+		}
+		_value = value;
+		analogWrite(_pin, value);
+	}
+	inline void invalidate() { _value = -1; }
+};
+
+#endif
@@ -0,0 +1,32 @@
+/***************************************************
+Uses: Integer math helpers shared by the fixed point modules
+(orientation filter, motion profile), so none of them pull in
+floating point for a square root.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_FixedMath.h"
+
+uint16_t CRC_FixedMath::isqrt(uint32_t value) {
+	uint32_t result = 0;
+	uint32_t bit = 1UL << 30;
+	while (bit > value) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+	return result;
+}
@@ -0,0 +1,28 @@
+/***************************************************
+Uses: Integer math helpers shared by the fixed point modules
+(orientation filter, motion profile), so none of them pull in
+floating point for a square root.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_FIXEDMATH_h
+#define _CRC_FIXEDMATH_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+class CRC_FixedMath {
+public:
+	// Integer square root, rounded down
+	static uint16_t isqrt(uint32_t value);
+};
+
+#endif
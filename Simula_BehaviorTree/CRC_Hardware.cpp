@@ -12,6 +12,7 @@ See README.md for license details
 
 #include <SD.h>
 #include <SPI.h>
+#include "CRC_SpiBus.h"
 #include <Wire.h>
 
 #include "CRC_Hardware.h"
@@ -102,10 +103,7 @@ void CRC_HardwareClass::setupI2C()
 }
 void CRC_HardwareClass::setupSPI()
 {
-	SPI.begin();
-	SPI.setDataMode(SPI_MODE0);
-	SPI.setBitOrder(MSBFIRST);
-	SPI.setClockDivider(SPI_CLOCK_DIV128);
+	crcSpiBus.begin();
 }
 void CRC_HardwareClass::startScanStatus(unsigned long startTime)
 {
@@ -113,7 +111,7 @@ void CRC_HardwareClass::startScanStatus(unsigned long startTime)
 	// Keep this block as is at start of this method
 	extern int __heap_start, *__brkval;
 	int v;
-	hardwareState.freeRam = (uint16_t)(&v - (__brkval == 0 ? (uint16_t)&__heap_start : (uint16_t)__brkval));
+	hardwareState.freeRam = (uint16_t)&v - (__brkval == 0 ? (uint16_t)&__heap_start : (uint16_t)__brkval);
 	// Scan Free Ram END
 };
 void CRC_HardwareClass::endScanStatus(unsigned long startTime)
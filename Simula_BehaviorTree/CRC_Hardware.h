@@ -42,55 +42,102 @@ class CRC_HardwareClass
 public:
 	// Define Pin's by Hardware Revisions
 	// Default to the ALPHA Units Pinouts
+	// Pins are static so CRC_FastPin can resolve them at compile time.
 #ifndef _CRC_BOARD_VER_
 #define _CRC_BOARD_VER_    ALPHA
-	const byte enc1A = 3;
-	const byte enc1B = 2;
-	const byte pinButtonA = 5;
-	const byte pinButtonB = 38;
-	const byte pinButtonC = A3;
-	const byte pinButtonLED = 13;
-	const byte enc2A = 18;
-	const byte enc2B = 19;
-	const byte mtr1In1 = 24;
-	const byte mtr1In2 = 22;
-	const byte mtr1Enable = 44;
-	const byte mtr2In1 = 23;
-	const byte mtr2In2 = 25;
-	const byte mtr2Enable = 45;
+	static const byte enc1A = 3;
+	static const byte enc1B = 2;
+	static const byte pinButtonA = 5;
+	static const byte pinButtonB = 38;
+	static const byte pinButtonC = A3;
+	static const byte pinButtonLED = 13;
+	static const byte enc2A = 18;
+	static const byte enc2B = 19;
+	static const byte mtr1In1 = 24;
+	static const byte mtr1In2 = 22;
+	static const byte mtr1Enable = 44;
+	static const byte mtr2In1 = 23;
+	static const byte mtr2In2 = 25;
+	static const byte mtr2Enable = 45;
 
 	// VS1053 Control
-	const byte vs1053_dcs = 8;
-	const byte vs1053_reset = 9;
-	const byte vs1053_cs = 10;   // SPI CS for VS 1053 Control Port
-	const byte vs1053_dreq = 12; // SPI CS for VS 1053 Data Port
-	const byte pinAmpGain0 = 37;
-	const byte pinAmpGain1 = 40;
-	const byte pinAmpEnable = 41;
-	const byte sdcard_cs = 4; // SPI Chip Select for SD Card
-	const byte pinBatt = A2;
+	static const byte vs1053_dcs = 8;
+	static const byte vs1053_reset = 9;
+	static const byte vs1053_cs = 10;   // SPI CS for VS 1053 Control Port
+	static const byte vs1053_dreq = 12; // VS 1053 data request, PB6 / PCINT6
+	static const byte pinAmpGain0 = 37;
+	static const byte pinAmpGain1 = 40;
+	static const byte pinAmpEnable = 41;
+	const unsigned int audioFeedBudgetMicros = 300;	// Longest one feed may hold the bus, about 8 chunks at 8 MHz
+	static const byte sdcard_cs = 4; // SPI Chip Select for SD Card
+	static const byte pinBatt = A2;
 
 	// IR Sensor pins
-	const byte pinEdge1 = A0;
-	const byte pinActEdge1 = 27;
-	const byte pinEdge2 = A1;
-	const byte pinActEdge2 = 31;
-	const byte pinPerim1 = A4;
-	const byte pinActPerim1 = 26;
-	const byte pinPerim2 = A5;
-	const byte pinActPerim2 = 28;
-	const byte pinPerim3 = A6;
-	const byte pinActPerim3 = 30;
-	const byte pinPerim4 = A7;
-	const byte pinActPerim4 = 32;
-	const byte pinFrntIr = A8;
-	const byte pinActFrntIR = 29;
+	static const byte pinEdge1 = A0;
+	static const byte pinActEdge1 = 27;
+	static const byte pinEdge2 = A1;
+	static const byte pinActEdge2 = 31;
+	static const byte pinPerim1 = A4;
+	static const byte pinActPerim1 = 26;
+	static const byte pinPerim2 = A5;
+	static const byte pinActPerim2 = 28;
+	static const byte pinPerim3 = A6;
+	static const byte pinActPerim3 = 30;
+	static const byte pinPerim4 = A7;
+	static const byte pinActPerim4 = 32;
+	static const byte pinFrntIr = A8;
+	static const byte pinActFrntIR = 29;
 	const byte irMinimumCM = 3;
+	const byte irAlarmCM = 11;			// Perimeter alarm enters below this distance
+	const byte irAlarmReleaseCM = 13;	// ...and releases at or above this one
+	const unsigned int irEdgeSettleMicros = 250;		// Emitter on to valid edge reading
+	// Perimeter and front are Sharp GP2Y0A analog modules, left powered while sensors are active.
+	// Datasheet: first valid output 38.3 +/- 9.6 ms after power on, plus up to 5 ms for the output.
+	const unsigned int irPerimeterStartupMs = 53;
+	const unsigned int irIdlePollMs = 250;		// Sample interval for every sensor while stopped
+	const unsigned int irMovingPollMs = 50;		// Slowest interval for edge and front facing sensors while moving
+	const unsigned int irMinPollMs = 20;		// Fastest sample interval
+	const unsigned int irSidePollMs = 100;		// Side IR and ping interval while moving
+	const unsigned int irSampleTravelPulses = 20;	// Encoder pulses travelled between edge/front samples
+	const byte irHardAlarmCM = 6;				// Perimeter alarm regardless of predicted contact
+	const byte irPredictMaxCM = 30;				// Predicted contact only acted on inside this range
+	const byte irNearCollisionCM = 5;			// Counted as a near collision when moving
+	const unsigned int irContactAlarmMs = 500;	// Turn when contact is predicted sooner than this
+	const byte irPingToleranceCM = 10;			// Front IR and ping may differ this much before disagreeing
+	const byte irDisagreeSamples = 10;			// Consecutive disagreeing sweeps before both are degraded
+
+	// Drive geometry
+	const unsigned int encoderPulsesPerMeter = 3000;	// Calibrate per unit
+	const unsigned int wheelBaseMM = 95;				// Wheel contact patch to contact patch
+	const unsigned int odometryPeriodMs = 20;
+
+	// Wheel speed PID, gains in 1/256 power per pulse/s
+	const unsigned int motorControlPeriodMs = 20;	// Velocity sample and control period
+	const int motorFeedForward = 40;				// Open loop power per pulse/s
+	const int motorKp = 26;
+	const int motorKi = 160;						// Per pulse/s of error held for a second
+	const int motorKd = 8;
+
+	// Motion profile limits, in encoder pulses
+	const int32_t motorAccel = 6000;			// pulses/s^2 speeding up
+	const int32_t motorDecel = 12000;			// pulses/s^2 slowing down
+	const int32_t motorJerk = 60000;			// pulses/s^3
+
+	// Stall detection, judged per control period over the last 16 periods
+	const int motorStallMinPower = 60;			// Below this a still wheel is just motor deadband
+	const byte motorStallSpeedPercent = 25;		// Stalled under this share of the speed the power should give
+	const byte motorStallSamples = 12;			// Stalled periods out of 16 that raise the stall
+	const int motorStallPowerCap = 200;			// accelerateToEncoderTarget never pushes harder
+
+	// Heading hold on straight runs, wheel speed trim in pulses/s
+	const int32_t headingKp = 20;				// Per degree of heading error
+	const int32_t headingKd = 3;				// Per degree/s of turn rate
+	const int32_t headingMaxTrim = 300;
 	
 
 	// Ping Sensors
-	const byte pinPingEcho = 6;
-	const byte pinPingTrigger = 7;
+	static const byte pinPingEcho = 6;
+	static const byte pinPingTrigger = 7;
 
 	// Free Pins with Breakouts
 	// const byte pinSpeaker = 11; // Unused, Breakout to Daughter Board
@@ -101,6 +148,7 @@ public:
 
 	const uint8_t i2cPca9635Left = 0x00;
 	const uint8_t i2cPca9635Right = 0x01;
+	const unsigned int lightsFrameMs = 20;	// Light shows render at most 50 frames a second
 
 	//Battery related
 	const float lowBatteryVoltage = 6.3; // Cutoff on battery voltage, below this Simula unstable
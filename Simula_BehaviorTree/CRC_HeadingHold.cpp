@@ -0,0 +1,76 @@
+/***************************************************
+Uses: Heading hold for straight runs. Trims the left/right
+wheel speeds each control period from the heading error and
+turn rate, so motor mismatch doesn't curve the robot.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_HeadingHold.h"
+#include "CRC_Hardware.h"
+#include "CRC_Motor.h"
+#include "CRC_Odometry.h"
+#include "CRC_Orientation.h"
+#include "CRC_Sensors.h"
+
+CRC_HeadingHold::CRC_HeadingHold() {
+	_active = false;
+	_velocity = 0;
+	_targetHeading = 0;
+	_trim = 0;
+	_lastUpdateMillis = 0;
+}
+
+void CRC_HeadingHold::driveStraight(int32_t velocity) {
+	_targetHeading = crcOdometry.heading();
+	_velocity = velocity;
+	_trim = 0;
+	_lastUpdateMillis = millis();
+	motors.setVelocity(velocity, velocity);
+	_active = true;
+}
+
+void CRC_HeadingHold::release() {
+	if (_active) {
+		motors.motorLeft->setTrim(0);
+		motors.motorRight->setTrim(0);
+	}
+	_active = false;
+	_trim = 0;
+}
+
+int32_t CRC_HeadingHold::turnRate() {
+	if (crcOdometry.gyroHeading()) {
+		return crcSensors.orientation.yawRate();
+	}
+	// Encoder difference in pulses/s, to millidegrees per second
+	return CRC_Odometry::pulsesToMillidegrees(motors.motorRight->velocity() - motors.motorLeft->velocity());
+}
+
+void CRC_HeadingHold::tick() {
+	if (!_active) {
+		return;
+	}
+	// Anything else taking the wheels (a reflex, a stop) ends the run.
+	if (motors.motorLeft->profileTarget() != _velocity || motors.motorRight->profileTarget() != _velocity) {
+		_active = false;
+		_trim = 0;
+		return;
+	}
+	unsigned long now = millis();
+	if (now - _lastUpdateMillis < crcHardware.motorControlPeriodMs) {
+		return;
+	}
+	_lastUpdateMillis = now;
+
+	// Heading is CCW positive and right minus left turns CCW, driving forward or back.
+	int32_t error = CRC_Orientation::wrapAngle(_targetHeading - crcOdometry.heading());
+	int32_t trim = (error * crcHardware.headingKp - turnRate() * crcHardware.headingKd) / 1000;
+	_trim = constrain(trim, -crcHardware.headingMaxTrim, crcHardware.headingMaxTrim);
+	motors.motorLeft->setTrim(-_trim);
+	motors.motorRight->setTrim(_trim);
+}
@@ -0,0 +1,44 @@
+/***************************************************
+Uses: Heading hold for straight runs. Trims the left/right
+wheel speeds each control period from the heading error and
+turn rate, so motor mismatch doesn't curve the robot.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_HEADINGHOLD_h
+#define _CRC_HEADINGHOLD_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+class CRC_HeadingHold {
+private:
+	boolean _active;
+	int32_t _velocity;
+	int32_t _targetHeading;		// millidegrees
+	int32_t _trim;				// Last correction, pulses/s added to the right wheel
+	unsigned long _lastUpdateMillis;
+
+	int32_t turnRate();
+public:
+	CRC_HeadingHold();
+	// Drive forward (or back) at pulses per second, holding the current heading.
+	void driveStraight(int32_t velocity);
+	void release();
+	// Call every loop, corrects once per motorControlPeriodMs.
+	void tick();
+	inline boolean active() { return _active; }
+	inline int32_t trim() { return _trim; }
+};
+
+extern CRC_HeadingHold crcHeadingHold;
+
+#endif
@@ -63,12 +63,12 @@ void CRC_HttpClient::sendUpdate(String & robotId)
 	//sensorString.concat("-" + crcSensors.irFrontCM);
 	//Serial.println(sensorString);
 
-	char szPostData[80];
+	char szPostData[96];
 	//sprintf_P(szPostData, (char *) F("{ID: \"%s\", S1: \"%s\"}"), robotId.c_str(), _voltage);
-	sprintf_P(szPostData, (char *)F("{ID: \"%s\", V: \"%s\", P: \"%u-%u-%u-%u-%u\", C: \"%d-%d\"}"), robotId.c_str(), _voltage, 
+	sprintf_P(szPostData, (char *)F("{ID: \"%s\", V: \"%s\", P: \"%u-%u-%u-%u-%u\", C: \"%d-%d\", H: \"%02x\"}"), robotId.c_str(), _voltage, 
 		crcSensors.irLeftCM, crcSensors.irLeftFrontCM, crcSensors.irFrontCM, 
 		crcSensors.irRightFrontCM, crcSensors.irRightCM, 
-		crcSensors.irLeftCliff, crcSensors.irRightCliff);
+		crcSensors.irLeftCliff, crcSensors.irRightCliff, crcSensors.degradedChannels());
 	Serial.print("payload:");
 	Serial.println(szPostData);
 
@@ -0,0 +1,210 @@
+/***************************************************
+Uses: Extends the Adafruit LSM9DS0 driver with a FIFO mode. The
+chip buffers samples at a fixed output data rate and we burst
+read only the enabled sensors, instead of reading accel, mag,
+gyro and temperature on every loop.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_IMU.h"
+#include <Wire.h>
+
+// LSM9DS0 registers used by the FIFO mode (accel/mag and gyro share the FIFO layout)
+#define LSM9DS0_REG_CTRL_REG0_XM	0x1F
+#define LSM9DS0_REG_CTRL_REG1_XM	0x20
+#define LSM9DS0_REG_CTRL_REG5_XM	0x24
+#define LSM9DS0_REG_CTRL_REG7_XM	0x26
+#define LSM9DS0_REG_CTRL_REG1_G		0x20
+#define LSM9DS0_REG_CTRL_REG5_G		0x24
+#define LSM9DS0_REG_OUT_X_L			0x28
+#define LSM9DS0_REG_FIFO_CTRL		0x2E
+#define LSM9DS0_REG_FIFO_SRC		0x2F
+
+#define LSM9DS0_FIFO_EN				0x40
+#define LSM9DS0_FIFO_MODE_BYPASS	0x00
+#define LSM9DS0_FIFO_MODE_STREAM	0x40
+#define LSM9DS0_FIFO_SRC_OVRN		0x40
+#define LSM9DS0_FIFO_SRC_FSS		0x1F
+#define LSM9DS0_AUTO_INCREMENT		0x80
+
+#define IMU_BYTES_PER_SAMPLE		6
+#define IMU_SAMPLES_PER_BURST		(BUFFER_LENGTH / IMU_BYTES_PER_SAMPLE)
+
+// Accelerometer output data rates, AODR code = index + 1
+static const uint16_t ACCEL_ODR_HZ[] = { 3, 6, 12, 25, 50, 100, 200, 400, 800, 1600 };
+static const unsigned long ACCEL_ODR_PERIOD[] = { 320000, 160000, 80000, 40000, 20000, 10000, 5000, 2500, 1250, 625 };
+// Gyro output data rates, DR code = index
+static const uint16_t GYRO_ODR_HZ[] = { 95, 190, 380, 760 };
+static const unsigned long GYRO_ODR_PERIOD[] = { 10526, 5263, 2632, 1316 };
+
+CRC_IMU::CRC_IMU() {
+	_fifoSensors = 0;
+	_accelPeriodMicros = 0;
+	_gyroPeriodMicros = 0;
+	_pollIntervalMicros = 0;
+	_lastPollMicros = 0;
+	_accelSamples.head = _accelSamples.count = 0;
+	_gyroSamples.head = _gyroSamples.count = 0;
+	fifoReads = 0;
+	fifoOverruns = 0;
+}
+
+void CRC_IMU::writeRegister(uint8_t address, uint8_t reg, uint8_t value) {
+	Wire.beginTransmission(address);
+	Wire.write(reg);
+	Wire.write(value);
+	Wire.endTransmission();
+}
+
+uint8_t CRC_IMU::readRegister(uint8_t address, uint8_t reg) {
+	Wire.beginTransmission(address);
+	Wire.write(reg);
+	Wire.endTransmission();
+	if (Wire.requestFrom(address, (uint8_t)1) != 1) {
+		return 0;
+	}
+	return Wire.read();
+}
+
+void CRC_IMU::enableFifo(uint8_t sensors, uint16_t rateHz, uint8_t batchSize) {
+	// Pick the fastest rate at or below rateHz (or the slowest available).
+	uint8_t accelOdr = 0;
+	while (accelOdr < 9 && ACCEL_ODR_HZ[accelOdr + 1] <= rateHz) {
+		accelOdr++;
+	}
+	uint8_t gyroOdr = 0;
+	while (gyroOdr < 3 && GYRO_ODR_HZ[gyroOdr + 1] <= rateHz) {
+		gyroOdr++;
+	}
+
+	// Magnetometer and temperature are not used, power them down.
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG5_XM, 0x70);
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG7_XM, 0x02);
+
+	if (sensors & IMU_ACCEL) {
+		_accelPeriodMicros = ACCEL_ODR_PERIOD[accelOdr];
+		writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG1_XM, ((accelOdr + 1) << 4) | 0x07);
+		// Bypass first to flush anything stale, then stream (oldest overwritten on overrun).
+		writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_FIFO_CTRL, LSM9DS0_FIFO_MODE_BYPASS);
+		writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG0_XM, LSM9DS0_FIFO_EN);
+		writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_FIFO_CTRL, LSM9DS0_FIFO_MODE_STREAM);
+	}
+	else {
+		writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG1_XM, 0x00);
+	}
+
+	if (sensors & IMU_GYRO) {
+		_gyroPeriodMicros = GYRO_ODR_PERIOD[gyroOdr];
+		writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_CTRL_REG1_G, (gyroOdr << 6) | 0x0F);
+		writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_FIFO_CTRL, LSM9DS0_FIFO_MODE_BYPASS);
+		writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_CTRL_REG5_G, LSM9DS0_FIFO_EN);
+		writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_FIFO_CTRL, LSM9DS0_FIFO_MODE_STREAM);
+	}
+	else {
+		writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_CTRL_REG1_G, 0x00);
+	}
+
+	// Poll at the slower of the enabled rates, once a batch has built up.
+	_pollIntervalMicros = max(_accelPeriodMicros, _gyroPeriodMicros) * max(batchSize, (uint8_t)1);
+	_lastPollMicros = micros();
+	_fifoSensors = sensors;
+}
+
+void CRC_IMU::disableFifo() {
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_FIFO_CTRL, LSM9DS0_FIFO_MODE_BYPASS);
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG0_XM, 0x00);
+	writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_FIFO_CTRL, LSM9DS0_FIFO_MODE_BYPASS);
+	writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_CTRL_REG5_G, 0x00);
+
+	// Back to the Adafruit defaults so read() works again.
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG1_XM, 0x67);
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG5_XM, 0xF0);
+	writeRegister(LSM9DS0_ADDRESS_ACCELMAG, LSM9DS0_REG_CTRL_REG7_XM, 0x00);
+	writeRegister(LSM9DS0_ADDRESS_GYRO, LSM9DS0_REG_CTRL_REG1_G, 0x0F);
+	_fifoSensors = 0;
+}
+
+uint8_t CRC_IMU::readFifo() {
+	if (!fifoEnabled()) {
+		return 0;
+	}
+	unsigned long now = micros();
+	if (now - _lastPollMicros < _pollIntervalMicros) {
+		return 0;
+	}
+	_lastPollMicros = now;
+
+	uint8_t samplesRead = 0;
+	if (_fifoSensors & IMU_ACCEL) {
+		samplesRead += drainFifo(LSM9DS0_ADDRESS_ACCELMAG, _accelPeriodMicros, now, _accelSamples, accelData);
+	}
+	if (_fifoSensors & IMU_GYRO) {
+		samplesRead += drainFifo(LSM9DS0_ADDRESS_GYRO, _gyroPeriodMicros, now, _gyroSamples, gyroData);
+	}
+	return samplesRead;
+}
+
+uint8_t CRC_IMU::drainFifo(uint8_t address, unsigned long periodMicros, unsigned long now, IMU_SAMPLE_BUFFER & buffer, lsm9ds0Vector_t & latest) {
+	uint8_t fifoSource = readRegister(address, LSM9DS0_REG_FIFO_SRC);
+	uint8_t pending = fifoSource & LSM9DS0_FIFO_SRC_FSS;
+	if (fifoSource & LSM9DS0_FIFO_SRC_OVRN) {
+		fifoOverruns++;
+	}
+
+	uint8_t remaining = pending;
+	IMU_SAMPLE sample;
+	while (remaining > 0) {
+		// Wire's buffer limits how many samples fit in one burst.
+		uint8_t burst = min(remaining, (uint8_t)IMU_SAMPLES_PER_BURST);
+		Wire.beginTransmission(address);
+		Wire.write(LSM9DS0_AUTO_INCREMENT | LSM9DS0_REG_OUT_X_L);
+		Wire.endTransmission();
+		if (Wire.requestFrom(address, (uint8_t)(burst * IMU_BYTES_PER_SAMPLE)) != burst * IMU_BYTES_PER_SAMPLE) {
+			break;
+		}
+		fifoReads++;
+
+		for (uint8_t i = 0; i < burst; i++) {
+			remaining--;
+			// Newest sample in the FIFO was taken at roughly 'now'
+			sample.timestamp = now - (unsigned long)remaining * periodMicros;
+			sample.x = Wire.read();
+			sample.x |= (int16_t)Wire.read() << 8;
+			sample.y = Wire.read();
+			sample.y |= (int16_t)Wire.read() << 8;
+			sample.z = Wire.read();
+			sample.z |= (int16_t)Wire.read() << 8;
+			pushSample(buffer, sample);
+		}
+	}
+
+	if (pending > remaining) {
+		latest.x = sample.x;
+		latest.y = sample.y;
+		latest.z = sample.z;
+	}
+	return pending - remaining;
+}
+
+void CRC_IMU::pushSample(IMU_SAMPLE_BUFFER & buffer, IMU_SAMPLE & sample) {
+	buffer.samples[buffer.head] = sample;
+	buffer.head = (buffer.head + 1) & (IMU_SAMPLE_BUFFER_LEN - 1);
+	if (buffer.count < IMU_SAMPLE_BUFFER_LEN) {
+		buffer.count++;
+	}
+}
+
+boolean CRC_IMU::popSample(IMU_SAMPLE_BUFFER & buffer, IMU_SAMPLE & sample) {
+	if (buffer.count == 0) {
+		return false;
+	}
+	uint8_t tail = (buffer.head - buffer.count) & (IMU_SAMPLE_BUFFER_LEN - 1);
+	sample = buffer.samples[tail];
+	buffer.count--;
+	return true;
+}
@@ -0,0 +1,81 @@
+/***************************************************
+Uses: Extends the Adafruit LSM9DS0 driver with a FIFO mode. The
+chip buffers samples at a fixed output data rate and we burst
+read only the enabled sensors, instead of reading accel, mag,
+gyro and temperature on every loop.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_IMU_h
+#define _CRC_IMU_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <Adafruit_LSM9DS0.h>
+
+#define IMU_SAMPLE_BUFFER_LEN	8	// Samples kept per sensor, power of two
+
+struct IMU_SAMPLE {
+	unsigned long timestamp;	// micros() at which the sample was taken
+	int16_t x;
+	int16_t y;
+	int16_t z;
+};
+
+class CRC_IMU : public Adafruit_LSM9DS0 {
+private:
+	struct IMU_SAMPLE_BUFFER {
+		IMU_SAMPLE samples[IMU_SAMPLE_BUFFER_LEN];
+		uint8_t head;
+		uint8_t count;
+	};
+
+	uint8_t _fifoSensors;
+	unsigned long _accelPeriodMicros;
+	unsigned long _gyroPeriodMicros;
+	unsigned long _pollIntervalMicros;
+	unsigned long _lastPollMicros;
+	IMU_SAMPLE_BUFFER _accelSamples;
+	IMU_SAMPLE_BUFFER _gyroSamples;
+
+	void writeRegister(uint8_t address, uint8_t reg, uint8_t value);
+	uint8_t readRegister(uint8_t address, uint8_t reg);
+	uint8_t drainFifo(uint8_t address, unsigned long periodMicros, unsigned long now, IMU_SAMPLE_BUFFER & buffer, lsm9ds0Vector_t & latest);
+	void pushSample(IMU_SAMPLE_BUFFER & buffer, IMU_SAMPLE & sample);
+	boolean popSample(IMU_SAMPLE_BUFFER & buffer, IMU_SAMPLE & sample);
+public:
+	static const uint8_t IMU_ACCEL = 0x01;
+	static const uint8_t IMU_GYRO = 0x02;
+
+	CRC_IMU();
+	// Enable the chip FIFOs for the given sensors (IMU_ACCEL | IMU_GYRO) at
+	// roughly rateHz, and read them back every batchSize samples.
+	// Magnetometer and temperature are powered down.
+	void enableFifo(uint8_t sensors, uint16_t rateHz, uint8_t batchSize = 4);
+	void disableFifo();
+	inline boolean fifoEnabled() { return _fifoSensors != 0; }
+	// Burst read whatever the FIFOs hold. Cheap to call every loop, only
+	// touches the I2C bus once a batch is due. Also updates accelData/gyroData
+	// with the newest sample. Returns number of samples read.
+	uint8_t readFifo();
+
+	inline uint8_t accelAvailable() { return _accelSamples.count; }
+	inline uint8_t gyroAvailable() { return _gyroSamples.count; }
+	boolean popAccel(IMU_SAMPLE & sample) { return popSample(_accelSamples, sample); }
+	boolean popGyro(IMU_SAMPLE & sample) { return popSample(_gyroSamples, sample); }
+
+	// Diagnostics
+	unsigned long fifoReads;		// I2C burst reads performed
+	unsigned long fifoOverruns;	// Samples lost because we polled too slowly
+};
+
+#endif
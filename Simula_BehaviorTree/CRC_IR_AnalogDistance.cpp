@@ -14,7 +14,10 @@ CRC_IR_AnalogDistance::CRC_IR_AnalogDistance(int activationPin, int readingPin)
 	: CRC_DistanceSensor(activationPin, readingPin) {}
 
 double CRC_IR_AnalogDistance::readDistance() {
-	int irValue = analogRead(_readingPin);
+	return toDistance(analogRead(_readingPin));
+}
+
+double CRC_IR_AnalogDistance::toDistance(int irValue) {
 	double irDistance = 187754 * pow(irValue, -1.51);
 	return irDistance;
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ class CRC_IR_AnalogDistance : public CRC_DistanceSensor {
 public:
 	CRC_IR_AnalogDistance(int activationPin, int readingPin);
 	double readDistance();
+	static double toDistance(int irValue);
 };
 
 #endif
@@ -0,0 +1,166 @@
+/***************************************************
+Uses: Plays LED light shows stored as PROGMEM keyframe
+timelines. Each keyframe gives every LED a palette color, a
+duration and an easing curve. tick() renders at most once per
+frame period and never waits, so a new show only costs flash.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_LightShow.h"
+#include "CRC_Lights.h"
+#include "CRC_Hardware.h"
+
+#define O	CRC_LightShow::COLOR_OFF
+#define T	CRC_LightShow::COLOR_THEME
+
+static const uint8_t LIGHT_PALETTE[][3] PROGMEM = {
+	{ 0, 0, 0 },		// COLOR_OFF
+	{ 0, 0, 0 },		// COLOR_THEME, taken from crcLights
+	{ 255, 255, 255 },	// COLOR_WHITE
+	{ 255, 0, 0 },		// COLOR_RED
+};
+
+// A pair of lights running from the back (L5/R5) to the front (L1/R1),
+// steps no shorter than two frame periods so none are passed over
+static const LIGHT_KEYFRAME RUNWAY_FRAMES[] PROGMEM = {
+	{ 40, CRC_LightShow::EASE_STEP, { O, O, O, O, T,  O, O, O, O, T } },
+	{ 40, CRC_LightShow::EASE_STEP, { O, O, O, T, O,  O, O, O, T, O } },
+	{ 40, CRC_LightShow::EASE_STEP, { O, O, T, O, O,  O, O, T, O, O } },
+	{ 40, CRC_LightShow::EASE_STEP, { O, T, O, O, O,  O, T, O, O, O } },
+	{ 40, CRC_LightShow::EASE_STEP, { T, O, O, O, O,  T, O, O, O, O } },
+};
+
+// 16 breaths a minute, a new color each breath
+static const LIGHT_KEYFRAME BREATH_FRAMES[] PROGMEM = {
+	{ 1875, CRC_LightShow::EASE_IN_OUT, { T, T, T, T, T,  T, T, T, T, T } },
+	{ 1875, CRC_LightShow::EASE_IN_OUT, { O, O, O, O, O,  O, O, O, O, O } },
+};
+
+#undef O
+#undef T
+
+static const LIGHT_TIMELINE LIGHT_SHOWS[] PROGMEM = {
+	{ RUNWAY_FRAMES, sizeof(RUNWAY_FRAMES) / sizeof(LIGHT_KEYFRAME), 5, CRC_LightShow::SHOW_CLEAR },
+	{ BREATH_FRAMES, sizeof(BREATH_FRAMES) / sizeof(LIGHT_KEYFRAME), 0, CRC_LightShow::SHOW_NEW_COLOR },
+};
+
+CRC_LightShow::CRC_LightShow() {
+	_show = NO_SHOW;
+}
+
+void CRC_LightShow::play(uint8_t show) {
+	if (show >= SHOW_COUNT) {
+		return;
+	}
+	memcpy_P(&_timeline, &LIGHT_SHOWS[show], sizeof(_timeline));
+	_show = show;
+	_frame = 0;
+	_loopsLeft = _timeline.loops;
+	memset(_from, 0, sizeof(_from));
+	if (_timeline.flags & SHOW_NEW_COLOR) {
+		crcLights.setRandomColor();
+	}
+	loadFrame();
+	_frameStart = millis();
+	// Draw the first frame on the next tick
+	_lastRender = _frameStart - crcHardware.lightsFrameMs;
+}
+
+void CRC_LightShow::stop() {
+	_show = NO_SHOW;
+}
+
+void CRC_LightShow::loadFrame() {
+	memcpy_P(&_target, &_timeline.frames[_frame], sizeof(_target));
+	if (_target.durationMs == 0) {
+		_target.durationMs = 1;
+	}
+}
+
+boolean CRC_LightShow::nextFrame() {
+	// The frame just finished is where the next fade starts
+	for (uint8_t led = 0; led < LIGHTS_LED_COUNT; led++) {
+		paletteColor(_target.colors[led], _from[led]);
+	}
+	_frame++;
+	if (_frame >= _timeline.frameCount) {
+		if (_timeline.loops != 0 && --_loopsLeft == 0) {
+			return false;
+		}
+		_frame = 0;
+		if (_timeline.flags & SHOW_NEW_COLOR) {
+			crcLights.setRandomColor();
+		}
+	}
+	loadFrame();
+	return true;
+}
+
+void CRC_LightShow::tick() {
+	if (_show == NO_SHOW) {
+		return;
+	}
+	unsigned long now = millis();
+	if (now - _lastRender < crcHardware.lightsFrameMs) {
+		return;
+	}
+	_lastRender = now;
+
+	// Frames shorter than the frame period are passed over, not slowed down
+	unsigned long elapsed = now - _frameStart;
+	while (elapsed >= _target.durationMs) {
+		elapsed -= _target.durationMs;
+		_frameStart += _target.durationMs;
+		if (!nextFrame()) {
+			_show = NO_SHOW;
+			if (_timeline.flags & SHOW_CLEAR) {
+				crcLights.setAllOff();
+			}
+			else {
+				render(256);
+			}
+			return;
+		}
+	}
+	render(ease(_target.easing, ((uint32_t)elapsed << 8) / _target.durationMs));
+}
+
+void CRC_LightShow::render(uint16_t weight) {
+	uint8_t to[3];
+	uint8_t rgb[3];
+	for (uint8_t led = 0; led < LIGHTS_LED_COUNT; led++) {
+		paletteColor(_target.colors[led], to);
+		for (uint8_t c = 0; c < 3; c++) {
+			rgb[c] = _from[led][c] + ((((int16_t)to[c] - _from[led][c]) * (int32_t)weight) >> 8);
+		}
+		crcLights.setLed(led, rgb[0], rgb[1], rgb[2]);
+	}
+}
+
+void CRC_LightShow::paletteColor(uint8_t index, uint8_t * rgb) {
+	if (index == COLOR_THEME) {
+		rgb[0] = crcLights.color_R;
+		rgb[1] = crcLights.color_G;
+		rgb[2] = crcLights.color_B;
+	}
+	else {
+		memcpy_P(rgb, LIGHT_PALETTE[index], 3);
+	}
+}
+
+uint16_t CRC_LightShow::ease(uint8_t easing, uint16_t t) {
+	// t and the result run 0..256
+	switch (easing) {
+	case EASE_LINEAR:
+		return t;
+	case EASE_IN_OUT:
+		return ((uint32_t)t * t * (768 - 2 * t)) >> 16;
+	default:
+		return 256;
+	}
+}
@@ -0,0 +1,87 @@
+/***************************************************
+Uses: Plays LED light shows stored as PROGMEM keyframe
+timelines. Each keyframe gives every LED a palette color, a
+duration and an easing curve. tick() renders at most once per
+frame period and never waits, so a new show only costs flash.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_LIGHTSHOW_h
+#define _CRC_LIGHTSHOW_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#define LIGHTS_LED_COUNT	10		// L1..L5 then R1..R5
+
+struct LIGHT_KEYFRAME {
+	uint16_t durationMs;				// Time taken to reach this frame from the previous one
+	uint8_t easing;						// CRC_LightShow::EASE_*
+	uint8_t colors[LIGHTS_LED_COUNT];	// Palette index per LED
+};
+
+struct LIGHT_TIMELINE {
+	const LIGHT_KEYFRAME * frames;		// In PROGMEM
+	uint8_t frameCount;
+	uint8_t loops;						// Times through the frames, 0 = until stopped
+	uint8_t flags;						// CRC_LightShow::SHOW_*
+};
+
+class CRC_LightShow {
+public:
+	// Order matches the timeline table in CRC_LightShow.cpp
+	enum LIGHT_SHOW : uint8_t {
+		SHOW_RUNWAY,
+		SHOW_BREATH,
+		SHOW_COUNT
+	};
+	static const uint8_t NO_SHOW = 0xFF;
+
+	// Palette, index 1 follows crcLights.color_R/G/B
+	static const uint8_t COLOR_OFF = 0;
+	static const uint8_t COLOR_THEME = 1;
+	static const uint8_t COLOR_WHITE = 2;
+	static const uint8_t COLOR_RED = 3;
+
+	static const uint8_t EASE_STEP = 0;		// Jump to the frame, then hold it
+	static const uint8_t EASE_LINEAR = 1;
+	static const uint8_t EASE_IN_OUT = 2;	// Smoothstep
+
+	static const uint8_t SHOW_NEW_COLOR = 0x01;	// Random theme color at the start of every loop
+	static const uint8_t SHOW_CLEAR = 0x02;		// All LEDs off once the show ends
+
+private:
+	uint8_t _show;
+	LIGHT_TIMELINE _timeline;
+	LIGHT_KEYFRAME _target;			// Frame being faded to
+	uint8_t _frame;
+	uint8_t _loopsLeft;
+	unsigned long _frameStart;
+	unsigned long _lastRender;
+	uint8_t _from[LIGHTS_LED_COUNT][3];	// Colors the current fade started from
+
+	void loadFrame();
+	boolean nextFrame();
+	void render(uint16_t weight);
+	static void paletteColor(uint8_t index, uint8_t * rgb);
+	static uint16_t ease(uint8_t easing, uint16_t t);
+
+public:
+	CRC_LightShow();
+	void play(uint8_t show);
+	// Leaves the LEDs as they are
+	void stop();
+	inline boolean isPlaying() { return _show != NO_SHOW; }
+	inline uint8_t current() { return _show; }
+	void tick();
+};
+
+#endif
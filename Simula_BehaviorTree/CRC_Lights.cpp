@@ -54,47 +54,8 @@ const uint8_t PROGMEM LIGHTS_LED_GAMMA[] =
 	215,218,220,223,225,228,231,233,236,239,241,244,247,249,252,255
 };
 
-const uint8_t PROGMEM aniRunway[5][5][3]= 
-{
-	{ //this means led 10 and 5 are on, the rest are off.
-		{ 10, 5, 1 },
-		{ 9, 4, 0 },
-		{ 8, 3, 0 },
-		{ 7, 2, 0 },
-		{ 6, 1, 0 }
-	},
-	{ //led 9 and 4 are on, the rest are off, etc.
-		{ 10, 5, 0 },
-		{ 9, 4, 1 },
-		{ 8, 3, 0 },
-		{ 7, 2, 0 },
-		{ 6, 1, 0 }
-	},
-	{
-		{ 10, 5, 0 },
-		{ 9, 4, 0 },
-		{ 8, 3, 1 },
-		{ 7, 2, 0 },
-		{ 6, 1, 0 }
-	},
-	{
-		{ 10, 5, 0 },
-		{ 9, 4, 0 },
-		{ 8, 3, 0 },
-		{ 7, 2, 1 },
-		{ 6, 1, 0 }
-	},
-	{
-		{ 10, 5, 0 },
-		{ 9, 4, 0 },
-		{ 8, 3, 0 },
-		{ 7, 2, 0 },
-		{ 6, 1, 1 }
-	}
-};
-
 CRC_LightsClass::CRC_LightsClass(uint8_t leftAddress, uint8_t rightAddress)
-	:ledLeft(leftAddress), ledRight(rightAddress)
+	:ledLeft(leftAddress), ledRight(rightAddress), buttonLed(crcHardware.pinButtonLED)
 {
 	allLedsOff = true;
 }
@@ -105,30 +66,15 @@ void CRC_LightsClass::init()
 	crcLogger.log(crcLogger.LOG_INFO, F("Lights initialized."));
 }
 void CRC_LightsClass::setButtonLevel(uint8_t level) {
-	analogWrite(crcHardware.pinButtonLED, level);
+	buttonLed.write(level);
 }
-void CRC_LightsClass::showRunwayWithDelay() {
-
-	for (int i = 0; i < 10; i++) {
-		crcLights.setLed(i, 0, 0, 0);
-	}
-
-	for (int k = 0; k < 5; k++) {
-		for (int j = 10; j > 4; j--) {
-			for (int i = 0; i < 10; i++) {
-				crcLights.setLed(i, 0, 0, 0);
-			}
-
-			crcLights.setLed(j, color_R, color_G, color_B);
-			crcLights.setLed(j - 5, color_R, color_G, color_B);
-
-			/*crcLights.setLed(j, 255, 0, 0);
-			crcLights.setLed(j - 5, 255, 0, 0);*/
-			delay(10);
-		}
-	}
-
-	setAllOff();
+void CRC_LightsClass::flush() {
+	ledLeft.flush();
+	ledRight.flush();
+}
+void CRC_LightsClass::tick() {
+	show.tick();
+	flush();
 }
 void CRC_LightsClass::setAllOff() {
 	if (!allLedsOff) {
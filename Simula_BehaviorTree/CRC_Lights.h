@@ -18,6 +18,8 @@ See README.md for license details
 #endif
 
 #include "CRC_PCA9635.h"
+#include "CRC_LightShow.h"
+#include "CRC_FastGpio.h"
 
 class CRC_LightsClass
 {
@@ -27,18 +29,23 @@ private:
 	CRC_PCA9635 ledRight;
 	inline void setLed(CRC_PCA9635 & ledBank, uint8_t ledNum, uint8_t level);
 	boolean allLedsOff;
+	CRC_CachedPwm buttonLed;
 	
 public:
 	CRC_LightsClass(uint8_t leftAddress, uint8_t rightAddress);
 	uint8_t color_R;
 	uint8_t color_G;
 	uint8_t color_B;
+	CRC_LightShow show;
 	void init();
 	void setLeftLed(uint8_t ledNum, uint8_t level); // 0=Off, 1000 = On, between 1-256 = Level
 	void setRightLed(uint8_t ledNum, uint8_t level); // 0=Off, 1000 = On, between 1-256 = Level
-	void showRunwayWithDelay();
 	void setButtonLevel(uint8_t level);
 	void setAllOff();
+	// LED changes are buffered, this sends them. Once per loop is enough.
+	void flush();
+	// Advance the light show, then flush
+	void tick();
 	void setRandomColor();
 	
 	boolean setLed(uint8_t ledId, uint8_t red, uint8_t green, uint8_t blue);
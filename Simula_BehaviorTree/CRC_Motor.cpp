@@ -9,23 +9,42 @@ See README.md for license details
 ****************************************************/
 
 #include "CRC_Motor.h"
+#include "CRC_Hardware.h"
+#include "CRC_FixedMath.h"
 
 CRC_Motor::CRC_Motor(int encoderPin1, int encoderPin2, int mtrEnable, int mtrIn1, int mtrIn2)
-	: Encoder(encoderPin1, encoderPin2) {
-	_mtrEnable = mtrEnable;
-	_mtrIn1 = mtrIn1;
-	_mtrIn2 = mtrIn2;
+	: CRC_Encoder(encoderPin1, encoderPin2), _mtrEnable(mtrEnable), _mtrIn1(mtrIn1), _mtrIn2(mtrIn2) {
 	_previousPosition = 0;
 	_previousRateCheckMillis = 0;
 	_stallPower = 0;
-	pinMode(_mtrEnable, OUTPUT);
-	pinMode(_mtrIn1, OUTPUT);
-	pinMode(_mtrIn2, OUTPUT);
+	_commandedPower = 0;
+	_velocityMillis = 0;
+	_velocity = 0;
+	_velocityControl = false;
+	_targetVelocity = 0;
+	_integral = 0;
+	_lastVelocity = 0;
+	_profiled = false;
+	_profileTarget = 0;
+	_profileAccel = 0;
+	_trim = 0;
+	_stallHistory = 0;
+	_stalled = false;
+	stallEvents = 0;
+	pinMode(mtrEnable, OUTPUT);
+	_mtrIn1.setOutput();
+	_mtrIn2.setOutput();
 	stop();
 	motorActive = false;
 }
 
 void CRC_Motor::setPower(int power) {
+	_velocityControl = false;
+	_trim = 0;
+	drive(power);
+}
+
+void CRC_Motor::drive(int power) {
 	boolean in1 = HIGH;
 	boolean in2 = LOW;
 
@@ -43,17 +62,116 @@ void CRC_Motor::setPower(int power) {
 		else {
 			motorActive = false;
 		}
-		analogWrite(_mtrEnable, abs(power));
-		digitalWrite(_mtrIn1, in1);
-		digitalWrite(_mtrIn2, in2);
+		_mtrEnable.write(abs(power));
+		_mtrIn1.write(in1);
+		_mtrIn2.write(in2);
+		_commandedPower = power;
 	}
 }
 
 void CRC_Motor::stop() {
-	analogWrite(_mtrEnable, 0);
-	digitalWrite(_mtrIn1, LOW);
-	digitalWrite(_mtrIn2, LOW);
+	_mtrEnable.write(0);
+	_mtrIn1.write(LOW);
+	_mtrIn2.write(LOW);
 	motorActive = false;
+	_commandedPower = 0;
+	_velocityControl = false;
+	_trim = 0;
+	_stallHistory = 0;
+	_stalled = false;
+}
+
+void CRC_Motor::tick() {
+	unsigned long _currentMillis = millis();
+	unsigned long _elapsed = _currentMillis - _velocityMillis;
+	if (_elapsed >= crcHardware.motorControlPeriodMs) {
+		_velocity = edgeVelocity();
+		_velocityMillis = _currentMillis;
+		if (_velocityControl && _profiled) {
+			updateProfile(_elapsed);
+		}
+		if (_velocityControl) {
+			updateVelocityControl(_elapsed);
+		}
+		updateStall();
+	}
+}
+
+void CRC_Motor::updateStall() {
+	int power = abs(_commandedPower);
+	int32_t expected = powerToRate(power);
+	bool stalledSample = power >= crcHardware.motorStallMinPower
+		&& abs(_velocity) * 100 < expected * crcHardware.motorStallSpeedPercent;
+	_stallHistory = (_stallHistory << 1) | (stalledSample ? 1 : 0);
+
+	uint8_t count = 0;
+	for (uint16_t history = _stallHistory; history != 0; history &= history - 1) {
+		count++;
+	}
+	if (!_stalled && count >= crcHardware.motorStallSamples) {
+		_stalled = true;
+		stallEvents++;
+	}
+	else if (_stalled && count < crcHardware.motorStallSamples / 2) {
+		_stalled = false;
+	}
+}
+
+void CRC_Motor::updateProfile(unsigned long elapsed) {
+	int32_t gap = _profileTarget - _targetVelocity;
+	if (gap == 0 && _profileAccel == 0) {
+		if (_profileTarget == 0) {
+			stop();
+		}
+		return;
+	}
+
+	// Slowing down when the step shrinks the speed, which may take the firmer limit.
+	bool slowing = (gap < 0) == (_targetVelocity > 0) && _targetVelocity != 0;
+	int32_t limit = slowing ? crcHardware.motorDecel : crcHardware.motorAccel;
+	// Ease off so acceleration reaches zero as the speed reaches the target: v = a^2 / 2j
+	int32_t easing = CRC_FixedMath::isqrt((uint32_t)2 * crcHardware.motorJerk * (uint32_t)abs(gap));
+	int32_t desired = min(limit, easing);
+	if (gap < 0) {
+		desired = -desired;
+	}
+
+	int32_t jerkStep = crcHardware.motorJerk * (int32_t)elapsed / 1000;
+	_profileAccel += constrain(desired - _profileAccel, -jerkStep, jerkStep);
+
+	int32_t step = _profileAccel * (int32_t)elapsed / 1000;
+	if (step == 0) {
+		step = (gap > 0) ? 1 : -1;
+	}
+	if ((gap > 0 && step >= gap) || (gap < 0 && step <= gap)) {
+		_targetVelocity = _profileTarget;
+		_profileAccel = 0;
+	}
+	else {
+		_targetVelocity += step;
+	}
+}
+
+void CRC_Motor::updateVelocityControl(unsigned long elapsed) {
+	int32_t setpoint = _targetVelocity + _trim;
+	int32_t error = setpoint - _velocity;
+	// Derivative on the measurement, so a new target doesn't kick the output.
+	int32_t derivative = _lastVelocity - _velocity;
+	_lastVelocity = _velocity;
+
+	int32_t output = (int32_t)crcHardware.motorFeedForward * setpoint
+		+ (int32_t)crcHardware.motorKp * error
+		+ (int32_t)crcHardware.motorKd * derivative;
+	int32_t step = (int32_t)crcHardware.motorKi * error * (int32_t)elapsed / 1000;
+
+	// Anti-windup: stop integrating once the output is pinned in the direction of the error.
+	int32_t unclamped = (output + _integral + step) >> 8;
+	if ((unclamped < 255 || step < 0) && (unclamped > -255 || step > 0)) {
+		_integral = constrain(_integral + step, -255L * 256, 255L * 256);
+	}
+
+	int32_t power = constrain((output + _integral) >> 8, -255L, 255L);
+	drive(power);
 }
 
 bool CRC_Motor::positionChanged() {
@@ -68,13 +186,16 @@ bool CRC_Motor::positionChanged() {
 
 void CRC_Motor::accelerateToEncoderTarget(int32_t encoderTarget, int powerTarget) {
 	unsigned long _currentMillis = millis();
+	if (_stalled) {
+		// Pushing harder won't help, leave it to the stall response.
+		stop();
+		return;
+	}
 	if (read() < encoderTarget) {
 		if (_currentMillis - _previousRateCheckMillis >= _rateCheckInterval) {
 			_previousRateCheckMillis = _currentMillis;
-			if (!positionChanged()) {
-				_stallPower += 5;
-				Serial.print(F("Stall power: "));
-				Serial.println(_stallPower);
+			if (edgeVelocity() == 0) {
+				_stallPower = min(_stallPower + 5, min(powerTarget, crcHardware.motorStallPowerCap));
 			}
 		}
 		setPower(_stallPower);
@@ -86,30 +207,40 @@ void CRC_Motor::accelerateToEncoderTarget(int32_t encoderTarget, int powerTarget
 }
 
 void CRC_Motor::setEncoderRate(int32_t pulsesPerSecond) {
-	//1000 millis per second
-	int _interval = 20;
-	int _convertedPulses = pulsesPerSecond * _interval / 1000;
-	unsigned long _currentMillis = millis();
-	if (_currentMillis - _previousRateCheckMillis >= _interval) {
-		_previousRateCheckMillis = _currentMillis;
-		int32_t _currentPosition = read();
-		int32_t _pulsesPerInterval = _currentPosition - _previousPosition;
-		_previousPosition = _currentPosition;
-		if (_pulsesPerInterval < _convertedPulses) {
-			_currentPower += 1;
-			setPower(_currentPower);
-		}
-		if (_pulsesPerInterval > _convertedPulses)
-		{
-			_currentPower -= 1;
-			setPower(_currentPower);
+	if (pulsesPerSecond == 0) {
+		stop();
+		return;
+	}
+	if (!_velocityControl || (pulsesPerSecond > 0) != (_targetVelocity > 0)) {
+		// Fresh start or reversal, the old integral points the wrong way.
+		_integral = 0;
+		_lastVelocity = _velocity;
+	}
+	_targetVelocity = pulsesPerSecond;
+	_velocityControl = true;
+	_profiled = false;
+	_trim = 0;
+}
+
+void CRC_Motor::rampToRate(int32_t pulsesPerSecond) {
+	if (!_velocityControl) {
+		if (pulsesPerSecond == 0 && _commandedPower == 0) {
+			stop();
+			return;
 		}
-		Serial.print(F("Current power: "));
-		Serial.println(_currentPower);
-		Serial.print(F("measuredPPS: "));
-		Serial.println(_pulsesPerInterval * 1000 / _interval);
-		Serial.print(F("targetPPS: "));
-		Serial.println(pulsesPerSecond);
+		// Pick up from the open loop speed. A stopped motor starts from 0 even while
+		// the wheel still coasts, or a reversal would first push on in the old direction.
+		_targetVelocity = (_commandedPower == 0) ? 0 : _velocity;
+		_integral = 0;
+		_lastVelocity = _velocity;
+		_profileAccel = 0;
+		_velocityControl = true;
 	}
+	_profileTarget = pulsesPerSecond;
+	_profiled = true;
+	_trim = 0;
+}
 
+int32_t CRC_Motor::powerToRate(int power) {
+	return (int32_t)power * 256 / crcHardware.motorFeedForward;
 }
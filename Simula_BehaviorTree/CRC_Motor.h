@@ -17,19 +17,44 @@ See README.md for license details
 	#include "WProgram.h"
 #endif
 
-#include <Encoder.h>
+#include "CRC_Encoder.h"
+#include "CRC_FastGpio.h"
 
-class CRC_Motor : public Encoder {
+class CRC_Motor : public CRC_Encoder {
 private:
-	int _mtrEnable;
-	int _mtrIn1;
-	int _mtrIn2;
+	CRC_CachedPwm _mtrEnable;
+	CRC_CachedPin _mtrIn1;
+	CRC_CachedPin _mtrIn2;
 	int32_t _previousPosition;
 	
 	unsigned long _previousRateCheckMillis;
 	const long _rateCheckInterval = 40;
 	int _stallPower;
-	int _currentPower;
+	int _commandedPower;
+
+	unsigned long _velocityMillis;
+	int32_t _velocity;
+
+	// Velocity control, active between setEncoderRate() and the next setPower()/stop()
+	bool _velocityControl;
+	int32_t _targetVelocity;
+	int32_t _integral;			// Integral term, power * 256
+	int32_t _lastVelocity;
+
+	// Motion profile, walks _targetVelocity towards _profileTarget under the accel/jerk limits
+	bool _profiled;
+	int32_t _profileTarget;
+	int32_t _profileAccel;		// pulses/s^2
+	int32_t _trim;				// Added to the PID setpoint, for steering corrections
+
+	// Stall detection, one bit per control period, newest in bit 0
+	uint16_t _stallHistory;
+	bool _stalled;
+
+	void drive(int power);
+	void updateStall();
+	void updateProfile(unsigned long elapsed);
+	void updateVelocityControl(unsigned long elapsed);
 public:
 	CRC_Motor(int encoderPin1, int encoderPin2, int mtrEnable, int mtrIn1, int mtrIn2);
 	void setPower(int power);
@@ -37,8 +62,26 @@ public:
 	bool positionChanged();
 	bool motorActive;
 	void accelerateToEncoderTarget(int32_t encoderTarget, int powerTarget);
-	//Set encoder pulses per second
+	//Set encoder pulses per second, held by the PID in tick() until setPower() or stop()
 	void setEncoderRate(int32_t pulsesPerSecond);
+	//Ramp to encoder pulses per second under the motion profile limits, stops once it ramps to 0
+	void rampToRate(int32_t pulsesPerSecond);
+	//Speed the PID settles at for an open loop power
+	static int32_t powerToRate(int power);
+	//Samples the encoder velocity and runs the speed control, call every loop
+	void tick();
+	//Measured encoder pulses per second, from edge periods at the last control period
+	inline int32_t velocity() { return _velocity; }
+	//Power currently driven, 0 when stopped
+	inline int commandedPower() { return _commandedPower; }
+	inline int32_t targetVelocity() { return _velocityControl ? _targetVelocity : 0; }
+	//Speed the profile is heading for, 0 when not under velocity control
+	inline int32_t profileTarget() { return (_velocityControl && _profiled) ? _profileTarget : 0; }
+	//Steering offset on top of the profiled speed, cleared by any new speed or power request
+	inline void setTrim(int32_t pulsesPerSecond) { _trim = pulsesPerSecond; }
+	//Driven hard but barely turning for most of the window, cleared by stop()
+	inline bool stalled() { return _stalled; }
+	unsigned long stallEvents;
 };
 
 class CRC_Motors {
@@ -49,15 +92,43 @@ public:
 		motorLeft = mtrLeft;
 		motorRight = mtrRight;
 	}
-	//power range: 0-255
+	//power range: -255-255, ramped to the matching closed loop speed
 	void setPower(int powerLeft, int powerRight) {
-		motorLeft->setPower(powerLeft);
-		motorRight->setPower(powerRight);
+		motorLeft->rampToRate(CRC_Motor::powerToRate(powerLeft));
+		motorRight->rampToRate(CRC_Motor::powerToRate(powerRight));
+	}
+	//Closed loop wheel speeds in encoder pulses per second, ramped
+	void setVelocity(int32_t velocityLeft, int32_t velocityRight) {
+		motorLeft->rampToRate(velocityLeft);
+		motorRight->rampToRate(velocityRight);
 	}
+	//power range: -255-255, held closed loop at once with no ramp, for reflexes
+	void setPowerNow(int powerLeft, int powerRight) {
+		motorLeft->setEncoderRate(CRC_Motor::powerToRate(powerLeft));
+		motorRight->setEncoderRate(CRC_Motor::powerToRate(powerRight));
+	}
+	//Ramp down to a stop
 	void allStop() {
+		motorLeft->rampToRate(0);
+		motorRight->rampToRate(0);
+	}
+	//Cut power now, for cliffs and shutdown
+	void emergencyStop() {
 		motorLeft->stop();
 		motorRight->stop();
 	}
+	void tick() {
+		motorLeft->tick();
+		motorRight->tick();
+	}
+	//Either wheel is pushing against something
+	bool stalled() {
+		return motorLeft->stalled() || motorRight->stalled();
+	}
+	//True when either wheel is driven, in either direction
+	bool moving() {
+		return motorLeft->commandedPower() != 0 || motorRight->commandedPower() != 0;
+	}
 	bool active() {
 		if (motorLeft->motorActive || motorRight->motorActive) {
 			return true;
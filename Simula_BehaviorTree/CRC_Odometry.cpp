@@ -0,0 +1,128 @@
+/***************************************************
+Uses: Dead reckoning pose (x, y, heading) from the wheel
+encoders, with heading taken from the gyro when it is
+running. Fixed point, updated at a fixed rate from the loop.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_Odometry.h"
+#include "CRC_Hardware.h"
+#include "CRC_Motor.h"
+#include "CRC_Sensors.h"
+
+// sin(0..90 degrees) in Q14
+const int16_t PROGMEM ODOMETRY_SIN_TABLE[] =
+{
+	0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+	2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+	5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+	8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+	10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+	12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+	14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+	15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+	16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+	16384
+};
+
+CRC_Odometry::CRC_Odometry() {
+	_lastLeft = 0;
+	_lastRight = 0;
+	_lastYaw = 0;
+	_lastUpdateMillis = 0;
+	_x = 0;
+	_y = 0;
+	_heading = 0;
+	_travelled = 0;
+	_gyroHeading = false;
+}
+
+void CRC_Odometry::reset() {
+	_x = 0;
+	_y = 0;
+	_heading = 0;
+	_travelled = 0;
+	_lastLeft = motors.motorLeft->read();
+	_lastRight = motors.motorRight->read();
+	_lastYaw = crcSensors.orientation.yaw();
+	_lastUpdateMillis = millis();
+}
+
+void CRC_Odometry::tick() {
+	unsigned long now = millis();
+	if (now - _lastUpdateMillis < crcHardware.odometryPeriodMs) {
+		return;
+	}
+	_lastUpdateMillis = now;
+	update();
+}
+
+void CRC_Odometry::update() {
+	int32_t left = motors.motorLeft->read();
+	int32_t right = motors.motorRight->read();
+	int32_t deltaLeft = left - _lastLeft;
+	int32_t deltaRight = right - _lastRight;
+	_lastLeft = left;
+	_lastRight = right;
+
+	// Heading from the gyro while its FIFO is being read, wheels slip but the gyro doesn't.
+	int32_t yaw = crcSensors.orientation.yaw();
+	int32_t turn;
+	boolean gyroHeading = hardwareState.sensorsActive && crcSensors.imu.fifoEnabled();
+	if (gyroHeading && _gyroHeading) {
+		turn = CRC_Orientation::wrapAngle(yaw - _lastYaw);
+	}
+	else {
+		turn = pulsesToMillidegrees(deltaRight - deltaLeft);
+	}
+	_lastYaw = yaw;
+	_gyroHeading = gyroHeading;
+
+	// Move along the mid-period heading. 64 bit intermediates, a Q14 product overflows
+	// 32 bits past 131 mm in one step.
+	int32_t forward = (int64_t)(deltaLeft + deltaRight) * 500000L / crcHardware.encoderPulsesPerMeter;
+	int32_t midHeading = _heading + turn / 2;
+	_x += ((int64_t)forward * cosMilli(midHeading)) >> 14;
+	_y += ((int64_t)forward * sinMilli(midHeading)) >> 14;
+	_travelled += forward;
+
+	_heading = CRC_Orientation::wrapAngle(_heading + turn);
+}
+
+int32_t CRC_Odometry::pulsesToMillidegrees(int32_t pulseDifference) {
+	// (right - left) / wheel base in radians: pulses * 1000 / (pulses per meter * base mm),
+	// at 57295780 millidegrees per radian * 1000.
+	return (int64_t)pulseDifference * 57295780LL
+		/ ((int32_t)crcHardware.encoderPulsesPerMeter * (int32_t)crcHardware.wheelBaseMM);
+}
+
+int32_t CRC_Odometry::turnedSince(int32_t startHeading) {
+	return CRC_Orientation::wrapAngle(_heading - startHeading);
+}
+
+int16_t CRC_Odometry::sinMilli(int32_t angle) {
+	angle %= 360000;
+	if (angle < 0) {
+		angle += 360000;
+	}
+	boolean negative = angle >= 180000;
+	if (negative) {
+		angle -= 180000;
+	}
+	if (angle > 90000) {
+		angle = 180000 - angle;
+	}
+
+	uint8_t index = angle / 1000;
+	int16_t value = pgm_read_word(&ODOMETRY_SIN_TABLE[index]);
+	if (index < 90) {
+		int16_t next = pgm_read_word(&ODOMETRY_SIN_TABLE[index + 1]);
+		value += (int32_t)(next - value) * (angle % 1000) / 1000;
+	}
+	return negative ? -value : value;
+}
@@ -0,0 +1,62 @@
+/***************************************************
+Uses: Dead reckoning pose (x, y, heading) from the wheel
+encoders, with heading taken from the gyro when it is
+running. Fixed point, updated at a fixed rate from the loop.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_ODOMETRY_h
+#define _CRC_ODOMETRY_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+class CRC_Odometry {
+private:
+	// Position in micrometers, heading in millidegrees (CCW positive).
+	int32_t _x;
+	int32_t _y;
+	int32_t _heading;
+	int32_t _travelled;		// Signed path length, micrometers
+	int32_t _lastLeft;
+	int32_t _lastRight;
+	int32_t _lastYaw;
+	boolean _gyroHeading;	// Heading followed the gyro on the last update
+	unsigned long _lastUpdateMillis;
+
+	void update();
+public:
+	CRC_Odometry();
+	// Zero the pose at the robot's current position
+	void reset();
+	// Call every loop, integrates once per odometryPeriodMs
+	void tick();
+
+	inline int32_t x() { return _x / 1000; }			// mm
+	inline int32_t y() { return _y / 1000; }			// mm
+	inline int32_t heading() { return _heading; }		// millidegrees, -180000..180000
+	inline int32_t distance() { return _travelled / 1000; }	// mm, backwards counts down
+	// Heading is following the gyro rather than the wheels
+	inline boolean gyroHeading() { return _gyroHeading; }
+	// Angle turned since a heading() snapshot, wrapped to +-180 degrees
+	int32_t turnedSince(int32_t startHeading);
+
+	// Heading change in millidegrees for a right minus left encoder pulse difference,
+	// also turns a wheel speed difference in pulses/s into millidegrees/s
+	static int32_t pulsesToMillidegrees(int32_t pulseDifference);
+	// sin/cos in Q14 of an angle in millidegrees, table based
+	static int16_t sinMilli(int32_t angle);
+	static inline int16_t cosMilli(int32_t angle) { return sinMilli(angle + 90000); }
+};
+
+extern CRC_Odometry crcOdometry;
+
+#endif
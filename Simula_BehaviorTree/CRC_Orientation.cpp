@@ -0,0 +1,145 @@
+/***************************************************
+Uses: Fixed point complementary filter fusing the LSM9DS0
+accelerometer and gyro into roll, pitch and yaw, plus a
+debounced tilt flag for the behavior tree.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_Orientation.h"
+#include "CRC_FixedMath.h"
+
+#define ORIENTATION_ACCEL_SHIFT		5		// Accel correction gain 1/32 per sample, ~0.3s at 100 Hz
+#define ORIENTATION_BIAS_SHIFT		6		// Gyro bias learning gain 1/64 per still sample
+#define ORIENTATION_STILL_RAW		(230 * 16)	// ~2 DPS, below this the robot is treated as still
+#define ORIENTATION_MAX_DT			100000	// Ignore gaps longer than this (micros)
+#define ORIENTATION_TILT_ON			25000	// Tilted above 25 degrees roll or pitch...
+#define ORIENTATION_TILT_OFF		15000	// ...and level again below 15 degrees
+
+CRC_Orientation::CRC_Orientation() {
+	_biasX = 0;
+	_biasY = 0;
+	_biasZ = 0;
+	reset();
+}
+
+void CRC_Orientation::reset() {
+	_roll = 0;
+	_pitch = 0;
+	_yaw = 0;
+	_yawRate = 0;
+	_gyroStarted = false;
+	_accelStarted = false;
+	_tilted = false;
+}
+
+void CRC_Orientation::update(CRC_IMU & imu) {
+	IMU_SAMPLE sample;
+	while (imu.popGyro(sample)) {
+		updateGyro(sample);
+	}
+	while (imu.popAccel(sample)) {
+		updateAccel(sample);
+	}
+}
+
+void CRC_Orientation::updateGyro(const IMU_SAMPLE & gyro) {
+	if (!_gyroStarted) {
+		_lastGyroTimestamp = gyro.timestamp;
+		_gyroStarted = true;
+		return;
+	}
+	unsigned long dt = gyro.timestamp - _lastGyroTimestamp;
+	_lastGyroTimestamp = gyro.timestamp;
+	if (dt > ORIENTATION_MAX_DT) {
+		dt = ORIENTATION_MAX_DT;
+	}
+
+	// Raw counts * 16 with bias removed
+	int32_t rx = ((int32_t)gyro.x << 4) - _biasX;
+	int32_t ry = ((int32_t)gyro.y << 4) - _biasY;
+	int32_t rz = ((int32_t)gyro.z << 4) - _biasZ;
+
+	if (abs(rx) < ORIENTATION_STILL_RAW && abs(ry) < ORIENTATION_STILL_RAW && abs(rz) < ORIENTATION_STILL_RAW) {
+		_biasX += rx >> ORIENTATION_BIAS_SHIFT;
+		_biasY += ry >> ORIENTATION_BIAS_SHIFT;
+		_biasZ += rz >> ORIENTATION_BIAS_SHIFT;
+	}
+
+	// 245 DPS scale is 8.75 mdps per count, so rate = (raw * 16) * 35 / 64
+	int32_t rateX = (rx * 35) >> 6;
+	int32_t rateY = (ry * 35) >> 6;
+	int32_t rateZ = (rz * 35) >> 6;
+
+	// delta = rate * dt / 1000000, done in 16us steps to stay inside 32 bits
+	int32_t ticks = dt >> 4;
+	_roll = wrapAngle(_roll + rateX * ticks / 62500);
+	_pitch = wrapAngle(_pitch + rateY * ticks / 62500);
+	_yaw = wrapAngle(_yaw + rateZ * ticks / 62500);
+	_yawRate = rateZ;
+}
+
+void CRC_Orientation::updateAccel(const IMU_SAMPLE & accel) {
+	int32_t y = accel.y;
+	int32_t z = accel.z;
+	int32_t accelRoll = atan2Milli(y, z);
+	int32_t accelPitch = atan2Milli(-(int32_t)accel.x, CRC_FixedMath::isqrt((uint32_t)(y * y) + (uint32_t)(z * z)));
+
+	if (!_accelStarted) {
+		_roll = accelRoll;
+		_pitch = accelPitch;
+		_accelStarted = true;
+	}
+	else {
+		_roll = wrapAngle(_roll + (wrapAngle(accelRoll - _roll) >> ORIENTATION_ACCEL_SHIFT));
+		_pitch = wrapAngle(_pitch + (wrapAngle(accelPitch - _pitch) >> ORIENTATION_ACCEL_SHIFT));
+	}
+
+	int32_t lean = max(abs(_roll), abs(_pitch));
+	if (!_tilted && lean > ORIENTATION_TILT_ON) {
+		_tilted = true;
+	}
+	else if (_tilted && lean < ORIENTATION_TILT_OFF) {
+		_tilted = false;
+	}
+}
+
+int32_t CRC_Orientation::wrapAngle(int32_t angle) {
+	if (angle > 180000) {
+		angle -= 360000;
+	}
+	else if (angle <= -180000) {
+		angle += 360000;
+	}
+	return angle;
+}
+
+int32_t CRC_Orientation::atan2Milli(int32_t y, int32_t x) {
+	if (x == 0 && y == 0) {
+		return 0;
+	}
+	uint32_t ax = abs(x);
+	uint32_t ay = abs(y);
+	boolean steep = ay > ax;
+	uint32_t num = steep ? ax : ay;
+	uint32_t den = steep ? ay : ax;
+
+	// First octant: atan(z) ~= 45z + 15.64z(1 - z) degrees, z in Q15
+	uint32_t q = (num << 15) / den;
+	int32_t angle = (45000UL * q + 15640UL * ((q * (32768UL - q)) >> 15)) >> 15;
+
+	if (steep) {
+		angle = 90000 - angle;
+	}
+	if (x < 0) {
+		angle = 180000 - angle;
+	}
+	if (y < 0) {
+		angle = -angle;
+	}
+	return angle;
+}
@@ -0,0 +1,62 @@
+/***************************************************
+Uses: Fixed point complementary filter fusing the LSM9DS0
+accelerometer and gyro into roll, pitch and yaw, plus a
+debounced tilt flag for the behavior tree.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_ORIENTATION_h
+#define _CRC_ORIENTATION_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include "CRC_IMU.h"
+
+class CRC_Orientation {
+private:
+	// All angles in millidegrees, rates in millidegrees per second.
+	int32_t _roll;
+	int32_t _pitch;
+	int32_t _yaw;
+	int32_t _yawRate;
+	int32_t _biasX;		// Gyro bias in raw counts * 16
+	int32_t _biasY;
+	int32_t _biasZ;
+	unsigned long _lastGyroTimestamp;
+	boolean _gyroStarted;
+	boolean _accelStarted;
+	boolean _tilted;
+
+public:
+	CRC_Orientation();
+	void reset();
+	// Drain the IMU sample buffers and fold them in.
+	void update(CRC_IMU & imu);
+	// Integrate one gyro sample (245 DPS scale).
+	void updateGyro(const IMU_SAMPLE & gyro);
+	// Pull roll/pitch towards the accelerometer's gravity vector.
+	void updateAccel(const IMU_SAMPLE & accel);
+
+	inline int32_t roll() { return _roll; }
+	inline int32_t pitch() { return _pitch; }
+	inline int32_t yaw() { return _yaw; }
+	inline int32_t yawRate() { return _yawRate; }
+	// Picked up or tipped over
+	inline boolean isTilted() { return _tilted; }
+
+	// atan2 in millidegrees, max error about 0.3 degrees
+	static int32_t atan2Milli(int32_t y, int32_t x);
+	// Wrap a millidegree angle into -180000..180000
+	static int32_t wrapAngle(int32_t angle);
+};
+
+#endif
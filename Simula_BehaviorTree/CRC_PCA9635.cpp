@@ -1,5 +1,7 @@
 /***************************************************
-Uses: Provides functions to Control the PCA9635 LED driver
+Uses: Provides functions to Control the PCA9635 LED driver.
+Levels are kept in a RAM copy of the PWM registers and only
+the changed range is sent, in one auto-increment burst.
 
 This file is designed for the Simula project by Chicago Robotics Corp.
 http://www.chicagorobotics.net/products
@@ -16,8 +18,6 @@ See README.md for license details
 #define PCA9635_REG_LEDBASE 		0x02
 #define PCA9635_REG_LEDMODEBASE 	0x14
 
-#define PCA9635_NUM_LED				16
-
 #define PCA9635_AUTO_INCR       0x80
 
 
@@ -29,6 +29,9 @@ See README.md for license details
 CRC_PCA9635::CRC_PCA9635(uint8_t address)
 {
 	_address = address;
+	memset(_pwm, 0, sizeof(_pwm));
+	_dirtyFirst = PCA9635_NUM_LED;
+	_dirtyLast = 0;
 }
 
 void CRC_PCA9635::writeRegister(uint8_t regNum, byte* values, uint8_t size)
@@ -76,9 +79,10 @@ void CRC_PCA9635::init()
 void CRC_PCA9635::reset()
 {
 	// TODO, Send Software Reset
-	for (int i = 0; i < 15; i++) {
-		setLed(i, 0);
-	}
+	memset(_pwm, 0, sizeof(_pwm));
+	_dirtyFirst = 0;
+	_dirtyLast = PCA9635_NUM_LED - 1;
+	flush();
 }
 
 void CRC_PCA9635::setLedMode(uint8_t ledNum, uint8_t mode)
@@ -97,5 +101,24 @@ void CRC_PCA9635::setLedMode(uint8_t ledNum, uint8_t mode)
 
 void CRC_PCA9635::setLed(uint8_t ledNum, uint8_t level)
 {
-	writeRegister(PCA9635_REG_LEDBASE + ledNum, level);
+	if (ledNum >= PCA9635_NUM_LED || _pwm[ledNum] == level)
+	{
+		return;
+	}
+	_pwm[ledNum] = level;
+	_dirtyFirst = min(_dirtyFirst, ledNum);
+	_dirtyLast = max(_dirtyLast, ledNum);
+}
+
+void CRC_PCA9635::flush()
+{
+	if (!isDirty())
+	{
+		return;
+	}
+	// Unchanged channels inside the range are rewritten with the same value,
+	// still cheaper than a transaction per run.
+	writeRegister(PCA9635_AUTO_INCR | (PCA9635_REG_LEDBASE + _dirtyFirst), &_pwm[_dirtyFirst], _dirtyLast - _dirtyFirst + 1);
+	_dirtyFirst = PCA9635_NUM_LED;
+	_dirtyLast = 0;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 /***************************************************
-Uses: Provides functions to Control the PCA9635 LED driver
+Uses: Provides functions to Control the PCA9635 LED driver.
+Levels are kept in a RAM copy of the PWM registers and only
+the changed range is sent, in one auto-increment burst.
 
 This file is designed for the Simula project by Chicago Robotics Corp.
 http://www.chicagorobotics.net/products
@@ -17,11 +19,16 @@ See README.md for license details
 	#include "WProgram.h"
 #endif
 
+#define PCA9635_NUM_LED				16
+
 class CRC_PCA9635
 {
 protected:
 
 	uint8_t _address;
+	uint8_t _pwm[PCA9635_NUM_LED];	// What the PWM registers should hold
+	uint8_t _dirtyFirst;			// Changed channels not yet sent, first > last when clean
+	uint8_t _dirtyLast;
 
 	/**
 	* Sets the Mode
@@ -38,9 +45,15 @@ public:
 	void init();
 	void reset();
 	/**
-	* Sets the LED to the specified Level (0=Off, 255=On)
+	* Sets the LED to the specified Level (0=Off, 255=On), sent on the next flush()
 	*/
 	void setLed(uint8_t ledNum, uint8_t level);
+	inline uint8_t getLed(uint8_t ledNum) { return _pwm[ledNum]; }
+	inline boolean isDirty() { return _dirtyFirst <= _dirtyLast; }
+	/**
+	* Writes the changed PWM registers, nothing if none changed
+	*/
+	void flush();
 };
 
 #endif
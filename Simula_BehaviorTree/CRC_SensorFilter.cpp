@@ -0,0 +1,93 @@
+/***************************************************
+Uses: Streaming per-channel filter for sensor readings. Provides
+an optional 3 or 5 tap median, an exponential moving average and
+hysteresis thresholds, all in integer math over a small ring buffer.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_SensorFilter.h"
+
+CRC_SensorFilter::CRC_SensorFilter() {
+	_taps = MEDIAN_NONE;
+	_emaShift = 0;
+	_enterBelow = 0;
+	_exitAbove = 0;
+	reset();
+}
+
+void CRC_SensorFilter::configure(uint8_t medianTaps, uint8_t emaShift) {
+	if (medianTaps != MEDIAN_3 && medianTaps != MEDIAN_5) {
+		medianTaps = MEDIAN_NONE;
+	}
+	_taps = medianTaps;
+	_emaShift = min(emaShift, (uint8_t)8);
+	reset();
+}
+
+void CRC_SensorFilter::setHysteresis(uint16_t enterBelow, uint16_t exitAbove) {
+	_enterBelow = enterBelow;
+	_exitAbove = max(enterBelow, exitAbove);
+}
+
+void CRC_SensorFilter::reset() {
+	_head = 0;
+	_count = 0;
+	_emaAccumulator = 0;
+	_value = 0;
+	_below = false;
+}
+
+uint16_t CRC_SensorFilter::update(uint16_t rawValue) {
+	_ring[_head] = rawValue;
+	_head = (_head + 1) % _taps;
+	if (_count < _taps) {
+		_count++;
+	}
+
+	uint16_t sample = median();
+
+	if (_emaShift == 0) {
+		_value = sample;
+	}
+	else if (_count == 1) {
+		// Prime the average with the first sample instead of ramping up from zero.
+		_emaAccumulator = (uint32_t)sample << _emaShift;
+		_value = sample;
+	}
+	else {
+		_emaAccumulator = _emaAccumulator - (_emaAccumulator >> _emaShift) + sample;
+		_value = (_emaAccumulator + (1UL << (_emaShift - 1))) >> _emaShift;
+	}
+
+	if (!_below && _value < _enterBelow) {
+		_below = true;
+	}
+	else if (_below && _value >= _exitAbove) {
+		_below = false;
+	}
+	return _value;
+}
+
+uint16_t CRC_SensorFilter::median() {
+	if (_count < _taps) {
+		// Not enough history yet, use the newest sample.
+		return _ring[(_head + _taps - 1) % _taps];
+	}
+
+	uint16_t sorted[SENSORFILTER_MAX_TAPS];
+	for (uint8_t i = 0; i < _taps; i++) {
+		uint16_t v = _ring[i];
+		uint8_t j = i;
+		while (j > 0 && sorted[j - 1] > v) {
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = v;
+	}
+	return sorted[_taps >> 1];
+}
@@ -0,0 +1,55 @@
+/***************************************************
+Uses: Streaming per-channel filter for sensor readings. Provides
+an optional 3 or 5 tap median, an exponential moving average and
+hysteresis thresholds, all in integer math over a small ring buffer.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_SENSORFILTER_h
+#define _CRC_SENSORFILTER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#define SENSORFILTER_MAX_TAPS	5
+
+class CRC_SensorFilter {
+private:
+	uint16_t _ring[SENSORFILTER_MAX_TAPS];
+	uint8_t _head;
+	uint8_t _count;
+	uint8_t _taps;
+	uint8_t _emaShift;
+	uint32_t _emaAccumulator;	// Filtered value scaled by 2^_emaShift
+	uint16_t _value;
+	uint16_t _enterBelow;
+	uint16_t _exitAbove;
+	boolean _below;
+
+	uint16_t median();
+public:
+	static const uint8_t MEDIAN_NONE = 1;
+	static const uint8_t MEDIAN_3 = 3;
+	static const uint8_t MEDIAN_5 = 5;
+
+	CRC_SensorFilter();
+	// medianTaps: MEDIAN_NONE, MEDIAN_3 or MEDIAN_5
+	// emaShift: smoothing factor of 1/2^emaShift, 0 = no smoothing
+	void configure(uint8_t medianTaps, uint8_t emaShift);
+	// Reading goes "below" under enterBelow and stays there until it reaches exitAbove.
+	void setHysteresis(uint16_t enterBelow, uint16_t exitAbove);
+	uint16_t update(uint16_t rawValue);
+	void reset();
+	inline uint16_t value() { return _value; }
+	inline boolean belowThreshold() { return _below; }
+};
+
+#endif
@@ -0,0 +1,107 @@
+/***************************************************
+Uses: Per-channel sensor health tracker. Watches the raw sample
+stream for stuck values, readings pinned at the ADC rails and a
+collapsed spread while the robot is moving, and reports fault
+flags in O(1) per sample.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_SensorHealth.h"
+
+#define HEALTH_STUCK_SAMPLES	100		// Identical judged samples before FAULT_STUCK
+#define HEALTH_RANGE_SAMPLES	20		// Consecutive out of range samples before FAULT_RANGE
+#define HEALTH_FLAT_SAMPLES		200		// Judged samples with no spread before FAULT_FLAT
+#define HEALTH_FLAT_DEVIATION	16		// One raw count, in raw * 16
+#define HEALTH_SHIFT			4		// Mean/deviation smoothing, 1/16 per sample
+
+CRC_SensorHealth::CRC_SensorHealth() {
+	_low = 0;
+	_high = 0xFFFF;
+	reset();
+}
+
+void CRC_SensorHealth::setRange(uint16_t low, uint16_t high) {
+	_low = low;
+	_high = high;
+}
+
+void CRC_SensorHealth::reset() {
+	_lastRaw = 0;
+	_repeatCount = 0;
+	_railCount = 0;
+	_flatCount = 0;
+	_mean = 0;
+	_deviation = 0;
+	_faults = FAULT_NONE;
+	_primed = false;
+}
+
+uint8_t CRC_SensorHealth::update(uint16_t raw, boolean judge) {
+	if (!_primed) {
+		_lastRaw = raw;
+		_mean = (int32_t)raw << 4;
+		_deviation = HEALTH_FLAT_DEVIATION * 4;
+		_primed = true;
+	}
+
+	// Range is judged on every sample, a railed input is wrong parked or not.
+	if (raw < _low || raw > _high) {
+		if (_railCount < HEALTH_RANGE_SAMPLES) {
+			_railCount++;
+		}
+	}
+	else {
+		_railCount = 0;
+	}
+
+	int32_t error = ((int32_t)raw << 4) - _mean;
+	_mean += error >> HEALTH_SHIFT;
+	_deviation += ((int32_t)abs(error) - (int32_t)_deviation) >> HEALTH_SHIFT;
+
+	if (judge) {
+		if (raw == _lastRaw) {
+			if (_repeatCount < HEALTH_STUCK_SAMPLES) {
+				_repeatCount++;
+			}
+		}
+		else {
+			_repeatCount = 0;
+		}
+		if (_deviation < HEALTH_FLAT_DEVIATION) {
+			if (_flatCount < HEALTH_FLAT_SAMPLES) {
+				_flatCount++;
+			}
+		}
+		else {
+			_flatCount = 0;
+		}
+	}
+	_lastRaw = raw;
+
+	uint8_t faults = _faults & FAULT_DISAGREE;
+	if (_repeatCount >= HEALTH_STUCK_SAMPLES) {
+		faults |= FAULT_STUCK;
+	}
+	if (_railCount >= HEALTH_RANGE_SAMPLES) {
+		faults |= FAULT_RANGE;
+	}
+	if (_flatCount >= HEALTH_FLAT_SAMPLES) {
+		faults |= FAULT_FLAT;
+	}
+	_faults = faults;
+	return _faults;
+}
+
+void CRC_SensorHealth::setDisagree(boolean disagree) {
+	if (disagree) {
+		_faults |= FAULT_DISAGREE;
+	}
+	else {
+		_faults &= ~FAULT_DISAGREE;
+	}
+}
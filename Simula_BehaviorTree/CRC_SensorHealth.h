@@ -0,0 +1,54 @@
+/***************************************************
+Uses: Per-channel sensor health tracker. Watches the raw sample
+stream for stuck values, readings pinned at the ADC rails and a
+collapsed spread while the robot is moving, and reports fault
+flags in O(1) per sample.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_SENSORHEALTH_h
+#define _CRC_SENSORHEALTH_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+class CRC_SensorHealth {
+private:
+	uint16_t _lastRaw;
+	uint8_t _repeatCount;
+	uint8_t _railCount;
+	uint8_t _flatCount;
+	uint16_t _low;
+	uint16_t _high;
+	int32_t _mean;			// Running mean, raw * 16
+	uint16_t _deviation;	// Running mean absolute deviation, raw * 16
+	uint8_t _faults;
+	boolean _primed;
+public:
+	static const uint8_t FAULT_NONE = 0x00;
+	static const uint8_t FAULT_STUCK = 0x01;		// Same value sample after sample
+	static const uint8_t FAULT_RANGE = 0x02;		// Pinned outside the plausible range
+	static const uint8_t FAULT_FLAT = 0x04;			// No spread while the scene is changing
+	static const uint8_t FAULT_DISAGREE = 0x08;		// Set by the owner on cross-check failure
+
+	CRC_SensorHealth();
+	// Plausible raw range, readings outside count towards FAULT_RANGE.
+	void setRange(uint16_t low, uint16_t high);
+	void reset();
+	// judge: the reading is driving behaviour while the robot moves, so it
+	// should be changing. Stuck and flat are only counted then.
+	uint8_t update(uint16_t raw, boolean judge);
+	void setDisagree(boolean disagree);
+	inline uint8_t faults() { return _faults; }
+	inline boolean degraded() { return _faults != FAULT_NONE; }
+};
+
+#endif
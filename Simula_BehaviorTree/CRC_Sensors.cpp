@@ -10,81 +10,443 @@ See README.md for license details
 ****************************************************/
 
 #include "CRC_Sensors.h"
-#include "CRC_IR_BinaryDistance.h"
 #include "CRC_IR_AnalogDistance.h"
 #include "CRC_PingDistance.h"
 #include "CRC_Hardware.h"
+#include "CRC_Motor.h"
 #include "CRC_Logger.h"
 
+// Sweep slots. Only the edge emitters are pulsed, the Sharp perimeter and front modules need
+// tens of ms after power on, so they stay powered and are read as they are.
+#define IR_SLOT_COUNT	2
+#define IR_SLOT_EDGE	0
+static const uint8_t IR_SLOTS[IR_SLOT_COUNT] = {
+	bit(CRC_Sensors::CHANNEL_EDGE_LEFT) | bit(CRC_Sensors::CHANNEL_EDGE_RIGHT),
+	bit(CRC_Sensors::CHANNEL_LEFT) | bit(CRC_Sensors::CHANNEL_LEFT_FRONT) | bit(CRC_Sensors::CHANNEL_FRONT) |
+		bit(CRC_Sensors::CHANNEL_RIGHT_FRONT) | bit(CRC_Sensors::CHANNEL_RIGHT)
+};
+
+// Clamp a converted distance into the 8 bit CM range the filters work in.
+static uint8_t clampCM(double distance) {
+	if (!(distance < 255)) {
+		return 255;
+	}
+	return (uint8_t)distance;
+}
+
 void CRC_Sensors::init() {
-	imu = Adafruit_LSM9DS0();
+	imu = CRC_IMU();
 	crcLogger.log(crcLogger.LOG_INFO, F("IMU initialized."));
+
+	_emitters[CHANNEL_EDGE_LEFT] = CRC_CachedPin(crcHardware.pinActEdge1);
+	_readingPins[CHANNEL_EDGE_LEFT] = crcHardware.pinEdge1;
+	_emitters[CHANNEL_EDGE_RIGHT] = CRC_CachedPin(crcHardware.pinActEdge2);
+	_readingPins[CHANNEL_EDGE_RIGHT] = crcHardware.pinEdge2;
+	_emitters[CHANNEL_LEFT] = CRC_CachedPin(crcHardware.pinActPerim1);
+	_readingPins[CHANNEL_LEFT] = crcHardware.pinPerim1;
+	_emitters[CHANNEL_LEFT_FRONT] = CRC_CachedPin(crcHardware.pinActPerim2);
+	_readingPins[CHANNEL_LEFT_FRONT] = crcHardware.pinPerim2;
+	_emitters[CHANNEL_FRONT] = CRC_CachedPin(crcHardware.pinActFrntIR);
+	_readingPins[CHANNEL_FRONT] = crcHardware.pinFrntIr;
+	_emitters[CHANNEL_RIGHT_FRONT] = CRC_CachedPin(crcHardware.pinActPerim3);
+	_readingPins[CHANNEL_RIGHT_FRONT] = crcHardware.pinPerim3;
+	_emitters[CHANNEL_RIGHT] = CRC_CachedPin(crcHardware.pinActPerim4);
+	_readingPins[CHANNEL_RIGHT] = crcHardware.pinPerim4;
+	_readingPins[CHANNEL_PING] = crcHardware.pinPingEcho;
+	for (uint8_t channel = 0; channel < CHANNEL_PING; channel++) {
+		_emitters[channel].setOutput();
+	}
+	_slot = SLOT_IDLE;
+	_dueMask = 0;
+	_rateWindowStart = 0;
+	_perimeterOnMillis = 0;
+	for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+		_pollIntervalMs[channel] = crcHardware.irIdlePollMs;
+		_lastSampleMillis[channel] = 0;
+		_sampleCount[channel] = 0;
+		_windowSamples[channel] = 0;
+		_sampleRate[channel] = 0;
+	}
+	emittersOff();
+
+	// Edge sensors filter the raw ADC value. Object detected below 480, lost above 520.
+	_filters[CHANNEL_EDGE_LEFT].configure(CRC_SensorFilter::MEDIAN_3, 0);
+	_filters[CHANNEL_EDGE_LEFT].setHysteresis(480, 520);
+	_filters[CHANNEL_EDGE_RIGHT].configure(CRC_SensorFilter::MEDIAN_3, 0);
+	_filters[CHANNEL_EDGE_RIGHT].setHysteresis(480, 520);
+
+	// Perimeter sensors filter CM, median to drop single bad reads, light EMA to smooth.
+	for (uint8_t channel = CHANNEL_LEFT; channel <= CHANNEL_RIGHT; channel++) {
+		_filters[channel].configure(CRC_SensorFilter::MEDIAN_3, 1);
+		_filters[channel].setHysteresis(crcHardware.irAlarmCM, crcHardware.irAlarmReleaseCM);
+	}
+
+	// Ping drops out to 0 on a missed echo, so use the wider median.
+	_filters[CHANNEL_PING].configure(CRC_SensorFilter::MEDIAN_5, 0);
+
+	// Perimeter and front IR are health checked on the lit ADC reading, pinned at a rail is a
+	// wiring fault. The edge modules are binary and sit at the top rail over a real cliff,
+	// so they get no range check.
+	for (uint8_t channel = CHANNEL_LEFT; channel <= CHANNEL_RIGHT; channel++) {
+		_health[channel].setRange(2, 1021);
+	}
+}
+
+void CRC_Sensors::resetFilters() {
+	for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+		_filters[channel].reset();
+		_predictors[channel].reset();
+		_health[channel].reset();
+	}
+	_nearCollisionMask = 0;
+	_degradedMask = 0;
+	_disagreeCount = 0;
+	irLeftCliff = true;
+	irRightCliff = true;
+}
+
+void CRC_Sensors::emittersOff() {
+	for (uint8_t channel = 0; channel < CHANNEL_PING; channel++) {
+		_emitters[channel].write(LOW);
+	}
+}
+
+void CRC_Sensors::perimeterOn() {
+	for (uint8_t channel = CHANNEL_LEFT; channel <= CHANNEL_RIGHT; channel++) {
+		_emitters[channel].write(HIGH);
+	}
+	_perimeterOnMillis = millis();
 }
 
 void CRC_Sensors::activate() {
-	//Activate sensors
-	digitalWrite(crcHardware.pinActEdge1, HIGH);
-	digitalWrite(crcHardware.pinActEdge2, HIGH);
-	digitalWrite(crcHardware.pinActPerim1, HIGH);
-	digitalWrite(crcHardware.pinActPerim2, HIGH);
-	digitalWrite(crcHardware.pinActPerim3, HIGH);
-	digitalWrite(crcHardware.pinActPerim4, HIGH);
-	digitalWrite(crcHardware.pinActFrntIR, HIGH);
+	//Activate sensors. Edge emitters stay off until the scheduler pulses them.
+	emittersOff();
+	perimeterOn();
+	resetFilters();
+	_slot = SLOT_IDLE;
+	for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+		_lastSampleMillis[channel] = 0;
+	}
 	lastIrPollSensors = 0;
 	hardwareState.sensorsActive = true;
 }
 
 void CRC_Sensors::deactivate() {
 	//Deactivate sensors
-	digitalWrite(crcHardware.pinActEdge1, LOW);
-	digitalWrite(crcHardware.pinActEdge2, LOW);
-	digitalWrite(crcHardware.pinActPerim1, LOW);
-	digitalWrite(crcHardware.pinActPerim2, LOW);
-	digitalWrite(crcHardware.pinActPerim3, LOW);
-	digitalWrite(crcHardware.pinActPerim4, LOW);
-	digitalWrite(crcHardware.pinActFrntIR, LOW);
+	emittersOff();
+	_slot = SLOT_IDLE;
 	lastIrPollSensors = 0;
 	hardwareState.sensorsActive = false;
 }
 
 void CRC_Sensors::readIR() {
-	CRC_IR_BinaryDistance edgeLeft = CRC_IR_BinaryDistance(crcHardware.pinActEdge1, crcHardware.pinEdge1);
-	CRC_IR_BinaryDistance edgeRight = CRC_IR_BinaryDistance(crcHardware.pinActEdge2, crcHardware.pinEdge2);
-	CRC_IR_AnalogDistance perimLeft = CRC_IR_AnalogDistance(crcHardware.pinActPerim1, crcHardware.pinPerim1);
-	CRC_IR_AnalogDistance perimLeftFront = CRC_IR_AnalogDistance(crcHardware.pinActPerim2, crcHardware.pinPerim2);
-	CRC_IR_AnalogDistance perimFront = CRC_IR_AnalogDistance(crcHardware.pinActFrntIR, crcHardware.pinFrntIr);
-	CRC_IR_AnalogDistance perimRightFront = CRC_IR_AnalogDistance(crcHardware.pinActPerim3, crcHardware.pinPerim3);
-	CRC_IR_AnalogDistance perimRight = CRC_IR_AnalogDistance(crcHardware.pinActPerim4, crcHardware.pinPerim4);
-	CRC_PingDistance frontPing = CRC_PingDistance(crcHardware.pinPingTrigger, crcHardware.pinPingEcho);
-
-	crcSensors.irLeftCM = perimLeft.readDistance();
-	crcSensors.irLeftFrontCM = perimLeftFront.readDistance();
-	crcSensors.irFrontCM = perimFront.readDistance();
-	crcSensors.irRightFrontCM = perimRightFront.readDistance();
-	crcSensors.irRightCM = perimRight.readDistance();
-	crcSensors.pingFrontCM = frontPing.readDistance();
-
-	//If there is no object detected, then we MAY have a cliff.
-	crcSensors.irLeftCliff = !edgeLeft.objectDetected();
-	crcSensors.irRightCliff = !edgeRight.objectDetected();
-	
+	// Start a sweep of the channels that are due, tick() advances it without blocking.
+	if (_slot != SLOT_IDLE) {
+		return;
+	}
+	updatePollRates();
+	_dueMask = dueChannels(millis());
+	if (_dueMask == 0) {
+		return;
+	}
+	_slot = 0;
+	_slotLit = false;
+	tick();
+}
+
+void CRC_Sensors::updatePollRates() {
+	if (!motors.moving()) {
+		// Parked or in Do_Nothing, nothing is going to drive us off an edge.
+		for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+			_pollIntervalMs[channel] = crcHardware.irIdlePollMs;
+		}
+		return;
+	}
+
+	// Sample edge and front sensors every irSampleTravelPulses of wheel travel,
+	// never slower than the old fixed 50 ms window.
+	int32_t speed = max(abs(motors.motorLeft->velocity()), abs(motors.motorRight->velocity()));
+	uint32_t interval = crcHardware.irMovingPollMs;
+	if (speed > 0) {
+		interval = (uint32_t)crcHardware.irSampleTravelPulses * 1000 / speed;
+		interval = constrain(interval, (uint32_t)crcHardware.irMinPollMs, (uint32_t)crcHardware.irMovingPollMs);
+	}
+
+	for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+		_pollIntervalMs[channel] = interval;
+	}
+	_pollIntervalMs[CHANNEL_LEFT] = crcHardware.irSidePollMs;
+	_pollIntervalMs[CHANNEL_RIGHT] = crcHardware.irSidePollMs;
+	_pollIntervalMs[CHANNEL_PING] = crcHardware.irSidePollMs;
+}
+
+uint8_t CRC_Sensors::dueChannels(unsigned long now) {
+	uint8_t due = 0;
+	for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+		if (now - _lastSampleMillis[channel] >= _pollIntervalMs[channel]) {
+			due |= bit(channel);
+		}
+	}
+	return due;
+}
+
+void CRC_Sensors::countSample(uint8_t channel) {
+	_lastSampleMillis[channel] = millis();
+	_sampleCount[channel]++;
+	_windowSamples[channel]++;
+}
+
+void CRC_Sensors::tick() {
+	unsigned long now = millis();
+	if (now - _rateWindowStart >= 1000) {
+		for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+			_sampleRate[channel] = _windowSamples[channel];
+			_windowSamples[channel] = 0;
+		}
+		_rateWindowStart = now;
+		crcLogger.logF(crcLogger.LOG_TRACE, F("Sensor Hz: %u %u %u %u %u %u %u %u"),
+			_sampleRate[0], _sampleRate[1], _sampleRate[2], _sampleRate[3],
+			_sampleRate[4], _sampleRate[5], _sampleRate[6], _sampleRate[7]);
+	}
+
+	// Skip slots with nothing due
+	while (_slot < IR_SLOT_COUNT && (IR_SLOTS[_slot] & _dueMask) == 0) {
+		_slot++;
+	}
+	if (_slot == SLOT_IDLE) {
+		return;
+	}
+	if (_slot == IR_SLOT_COUNT) {
+		finishSweep();
+		return;
+	}
+
+	uint8_t slotMask = IR_SLOTS[_slot] & _dueMask;
+	if (_slot != IR_SLOT_EDGE) {
+		// Powered modules, the output is valid once they are past startup. Until then
+		// the channels stay due.
+		if (millis() - _perimeterOnMillis >= crcHardware.irPerimeterStartupMs) {
+			for (uint8_t channel = CHANNEL_LEFT; channel < CHANNEL_PING; channel++) {
+				if (slotMask & bit(channel)) {
+					storeReading(channel, analogRead(_readingPins[channel]));
+				}
+			}
+		}
+		_slot++;
+		return;
+	}
+
+	if (!_slotLit) {
+		// Paired off-reading for ambient light, then pulse the edge emitters.
+		for (uint8_t channel = 0; channel < CHANNEL_LEFT; channel++) {
+			if (slotMask & bit(channel)) {
+				_ambient[channel] = analogRead(_readingPins[channel]);
+				_emitters[channel].write(HIGH);
+			}
+		}
+		_slotStartMicros = micros();
+		_slotLit = true;
+		return;
+	}
+
+	if (micros() - _slotStartMicros < crcHardware.irEdgeSettleMicros) {
+		return;
+	}
+
+	for (uint8_t channel = 0; channel < CHANNEL_LEFT; channel++) {
+		if (slotMask & bit(channel)) {
+			int lit = analogRead(_readingPins[channel]);
+			_emitters[channel].write(LOW);
+			storeReading(channel, lit);
+		}
+	}
+
+	_slotLit = false;
+	_slot++;
+}
+
+void CRC_Sensors::finishSweep() {
+	if (_dueMask & bit(CHANNEL_PING)) {
+		CRC_PingDistance frontPing = CRC_PingDistance(crcHardware.pinPingTrigger, crcHardware.pinPingEcho);
+		pingFrontCM = _filters[CHANNEL_PING].update(clampCM(frontPing.readDistance()));
+		countSample(CHANNEL_PING);
+		checkHealth(CHANNEL_PING, pingFrontCM, pingFrontCM < crcHardware.irPredictMaxCM);
+		crossCheckFront();
+	}
+
+	_slot = SLOT_IDLE;
+	_dueMask = 0;
 	lastIrPollSensors = millis();
 }
 
+void CRC_Sensors::storeReading(uint8_t channel, int lit) {
+	countSample(channel);
+
+	if (channel == CHANNEL_EDGE_LEFT || channel == CHANNEL_EDGE_RIGHT) {
+		// Edge outputs pull low on reflection, ambient light pulls the off-reading low too.
+		int value = constrain(1023 - (_ambient[channel] - lit), 0, 1023);
+		_filters[channel].update(value);
+		//If there is no object detected, then we MAY have a cliff.
+		boolean cliff = !_filters[channel].belowThreshold();
+		checkHealth(channel, lit, cliff);
+		if (channel == CHANNEL_EDGE_LEFT) {
+			irLeftCliff = cliff;
+		}
+		else {
+			irRightCliff = cliff;
+		}
+		return;
+	}
+
+	uint8_t cm = _filters[channel].update(clampCM(CRC_IR_AnalogDistance::toDistance(lit)));
+	checkHealth(channel, lit, cm < crcHardware.irPredictMaxCM);
+	switch (channel) {
+	case CHANNEL_LEFT:
+		irLeftCM = cm;
+		break;
+	case CHANNEL_LEFT_FRONT:
+		irLeftFrontCM = cm;
+		break;
+	case CHANNEL_FRONT:
+		irFrontCM = cm;
+		break;
+	case CHANNEL_RIGHT_FRONT:
+		irRightFrontCM = cm;
+		break;
+	case CHANNEL_RIGHT:
+		irRightCM = cm;
+		break;
+	}
+	predictContact(channel, cm);
+}
+
+int16_t CRC_Sensors::approachSpeed(uint8_t channel) {
+	// Only forward driving closes on what the front sensors see.
+	if (motors.motorLeft->commandedPower() <= 0 || motors.motorRight->commandedPower() <= 0) {
+		return 0;
+	}
+	int32_t pulses = (abs(motors.motorLeft->velocity()) + abs(motors.motorRight->velocity())) / 2;
+	int32_t mmPerSecond = pulses * 1000 / crcHardware.encoderPulsesPerMeter;
+	switch (channel) {
+	case CHANNEL_FRONT:
+		return mmPerSecond;
+	case CHANNEL_LEFT_FRONT:
+	case CHANNEL_RIGHT_FRONT:
+		return (mmPerSecond * 181) >> 8;	// cos(45)
+	default:
+		return 0;
+	}
+}
+
+void CRC_Sensors::predictContact(uint8_t channel, uint8_t cm) {
+	_predictors[channel].update(cm, crcHardware.irMinimumCM, millis(), approachSpeed(channel));
+
+	if (channel != CHANNEL_LEFT_FRONT && channel != CHANNEL_FRONT && channel != CHANNEL_RIGHT_FRONT) {
+		return;
+	}
+	boolean near = motors.moving() && cm > crcHardware.irMinimumCM && cm < crcHardware.irNearCollisionCM;
+	if (near && !(_nearCollisionMask & bit(channel))) {
+		nearCollisions++;
+		crcLogger.logF(crcLogger.LOG_TRACE, F("Near collision on channel %u, total %lu."), channel, nearCollisions);
+	}
+	if (near) {
+		_nearCollisionMask |= bit(channel);
+	}
+	else {
+		_nearCollisionMask &= ~bit(channel);
+	}
+}
+
+void CRC_Sensors::checkHealth(uint8_t channel, uint16_t raw, boolean asserting) {
+	_health[channel].update(raw, asserting && motors.moving());
+	updateDegraded(channel);
+}
+
+void CRC_Sensors::updateDegraded(uint8_t channel) {
+	boolean wasDegraded = degraded(channel);
+	if (_health[channel].degraded() == wasDegraded) {
+		return;
+	}
+
+	if (wasDegraded) {
+		_degradedMask &= ~bit(channel);
+		crcLogger.logF(crcLogger.LOG_INFO, F("Sensor channel %u recovered."), channel);
+	}
+	else {
+		_degradedMask |= bit(channel);
+		crcLogger.logF(crcLogger.LOG_WARN, F("Sensor channel %u degraded, faults 0x%02x."), channel, _health[channel].faults());
+	}
+}
+
+void CRC_Sensors::crossCheckFront() {
+	// Ping and front IR look the same way. Only compare inside the IR's useful range,
+	// a missed echo (0) says nothing.
+	uint8_t nearest = min(irFrontCM, pingFrontCM);
+	if (pingFrontCM == 0 || nearest >= crcHardware.irPredictMaxCM) {
+		return;
+	}
+	if (abs((int)irFrontCM - (int)pingFrontCM) > crcHardware.irPingToleranceCM) {
+		if (_disagreeCount < crcHardware.irDisagreeSamples) {
+			_disagreeCount++;
+		}
+	}
+	else {
+		_disagreeCount = 0;
+	}
+
+	boolean disagree = _disagreeCount >= crcHardware.irDisagreeSamples;
+	_health[CHANNEL_FRONT].setDisagree(disagree);
+	_health[CHANNEL_PING].setDisagree(disagree);
+	updateDegraded(CHANNEL_FRONT);
+	updateDegraded(CHANNEL_PING);
+}
+
+boolean CRC_Sensors::perimeterAlarm(uint8_t channel) {
+	if (degraded(channel)) {
+		// Front IR falls back on the ping, unless the two are the ones disagreeing.
+		if (channel == CHANNEL_FRONT && !degraded(CHANNEL_PING)) {
+			return pingFrontCM > crcHardware.irMinimumCM && pingFrontCM < crcHardware.irAlarmCM;
+		}
+		return false;
+	}
+	return _filters[channel].belowThreshold();
+}
+
+boolean CRC_Sensors::contactAlarm(uint8_t channel) {
+	if (degraded(channel)) {
+		// Nothing to predict from a reading we don't trust, the ping fallback
+		// already ignores anything at or under irMinimumCM
+		return perimeterAlarm(channel);
+	}
+	uint8_t cm = _filters[channel].value();
+	if (cm <= crcHardware.irMinimumCM) {
+		// Closer than the IR can measure, the reading is not a distance
+		return false;
+	}
+	if (!motors.moving()) {
+		// Nothing to predict from, fall back to the fixed alarm distance.
+		return perimeterAlarm(channel);
+	}
+	if (cm < crcHardware.irHardAlarmCM) {
+		return true;
+	}
+	return cm < crcHardware.irPredictMaxCM && _predictors[channel].ttcMillis() < crcHardware.irContactAlarmMs;
+}
+
 boolean CRC_Sensors::irReadingUpdated() {
 	unsigned long now = millis();
 	unsigned long diff = now - lastIrPollSensors;
 
-	if (lastIrPollSensors == 0)
+	if (_slot != SLOT_IDLE)
 	{
-		// First Read of Sensors - pre-debounce
-		return false;
+		// Sweep still in progress
+		return true;
 	}
 
-	if (diff < 50)
+	if (lastIrPollSensors == 0)
 	{
-		// 50 ms is still a fresh reading
-		return true;
+		// First Read of Sensors - pre-debounce
+		return false;
 	}
 
 	if (diff > 1200)
@@ -93,5 +455,8 @@ boolean CRC_Sensors::irReadingUpdated() {
 		return false;
 		//crcLogger.logF(crcLogger.LOG_TRACE, F("Forced IR Read: %ul"), diff);
 	}
-	return false;
+
+	// Fresh until a channel's motion dependent interval runs out
+	updatePollRates();
+	return dueChannels(now) == 0;
 }
@@ -18,28 +18,103 @@ See README.md for license details
 	#include "WProgram.h"
 #endif
 
-#include <Adafruit_LSM9DS0.h>
+#include "CRC_IMU.h"
+#include "CRC_Orientation.h"
+#include "CRC_SensorFilter.h"
+#include "CRC_ContactPredictor.h"
+#include "CRC_SensorHealth.h"
+#include "CRC_FastGpio.h"
 
 class CRC_Sensors {
 protected:
 	unsigned long lastIrPollSensors;
 public:
+	// Sensor channels, in filter order
+	static const uint8_t CHANNEL_EDGE_LEFT = 0;
+	static const uint8_t CHANNEL_EDGE_RIGHT = 1;
+	static const uint8_t CHANNEL_LEFT = 2;
+	static const uint8_t CHANNEL_LEFT_FRONT = 3;
+	static const uint8_t CHANNEL_FRONT = 4;
+	static const uint8_t CHANNEL_RIGHT_FRONT = 5;
+	static const uint8_t CHANNEL_RIGHT = 6;
+	static const uint8_t CHANNEL_PING = 7;
+	static const uint8_t CHANNEL_COUNT = 8;
+
 	void init();
 	void activate();
 	void deactivate();
+	// Starts a non-blocking sweep of the IR sensors, advanced by tick().
 	void readIR();
+	void tick();
 	boolean irReadingUpdated();
-	Adafruit_LSM9DS0 imu;
+	inline CRC_SensorFilter & filter(uint8_t channel) { return _filters[channel]; }
+	// Sample counters, total and over the last second
+	inline unsigned long sampleCount(uint8_t channel) { return _sampleCount[channel]; }
+	inline uint16_t sampleRate(uint8_t channel) { return _sampleRate[channel]; }
+	// Filtered reading is inside the alarm distance (with hysteresis). A degraded channel
+	// never alarms, except the front IR which falls back on the ping.
+	boolean perimeterAlarm(uint8_t channel);
+	// Speed aware alarm: early when contact is predicted soon, late when approaching slowly.
+	// Degraded channels answer as perimeterAlarm() does.
+	boolean contactAlarm(uint8_t channel);
+	inline uint16_t ttcMillis(uint8_t channel) { return _predictors[channel].ttcMillis(); }
+	unsigned long nearCollisions = 0;	// Moving readings inside irNearCollisionCM
+	// Health: CRC_SensorHealth fault flags per channel, and a bit per degraded channel.
+	// Degraded perimeter channels never alarm. A degraded edge holds the robot still
+	// (Edge_Fault_Hold) until activate() resets the health checks.
+	inline uint8_t channelFaults(uint8_t channel) { return _health[channel].faults(); }
+	inline uint8_t degradedChannels() { return _degradedMask; }
+	inline boolean degraded(uint8_t channel) { return (_degradedMask & bit(channel)) != 0; }
+	CRC_IMU imu;
+	CRC_Orientation orientation;
 
 	//Distance sensors
 	boolean irLeftCliff = true;		// Left cliff sensor reading
 	boolean irRightCliff = true;		// Right cliff sensor reading
+	//CM readings are median/EMA filtered, see init() for per-channel settings.
 	uint8_t irLeftCM = 0;			// Left IR CM reading
 	uint8_t irLeftFrontCM = 0;		// Left front IR CM reading
 	uint8_t irFrontCM = 0;			// Front IR CM reading
 	uint8_t irRightFrontCM = 0;		// Right front IR CM reading
 	uint8_t irRightCM = 0;			// Right IR CM reading
 	uint8_t pingFrontCM = 0;		// Front Ping CM Reading
+protected:
+	static const uint8_t SLOT_IDLE = 0xFF;
+
+	CRC_SensorFilter _filters[CHANNEL_COUNT];
+	CRC_ContactPredictor _predictors[CHANNEL_COUNT];
+	uint8_t _nearCollisionMask;
+	CRC_SensorHealth _health[CHANNEL_COUNT];
+	uint8_t _degradedMask;
+	uint8_t _disagreeCount;
+	CRC_CachedPin _emitters[CHANNEL_PING];
+	uint8_t _readingPins[CHANNEL_COUNT];
+	int _ambient[CHANNEL_LEFT];			// Edge emitter-off reading paired with the next lit one
+	uint8_t _slot;						// Slot being sampled, SLOT_IDLE between sweeps
+	boolean _slotLit;
+	unsigned long _slotStartMicros;
+	unsigned long _perimeterOnMillis;	// Perimeter modules powered, readings junk until irPerimeterStartupMs
+	uint8_t _dueMask;					// Channels sampled by the current sweep
+	uint16_t _pollIntervalMs[CHANNEL_COUNT];
+	unsigned long _lastSampleMillis[CHANNEL_COUNT];
+	unsigned long _sampleCount[CHANNEL_COUNT];
+	uint16_t _windowSamples[CHANNEL_COUNT];
+	uint16_t _sampleRate[CHANNEL_COUNT];
+	unsigned long _rateWindowStart;
+
+	void resetFilters();
+	void emittersOff();
+	void perimeterOn();
+	void storeReading(uint8_t channel, int lit);
+	void finishSweep();
+	void updatePollRates();
+	uint8_t dueChannels(unsigned long now);
+	void countSample(uint8_t channel);
+	int16_t approachSpeed(uint8_t channel);
+	void predictContact(uint8_t channel, uint8_t cm);
+	void checkHealth(uint8_t channel, uint16_t raw, boolean asserting);
+	void updateDegraded(uint8_t channel);
+	void crossCheckFront();
 };
 
 extern CRC_Sensors crcSensors;
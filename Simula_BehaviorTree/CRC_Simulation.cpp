@@ -18,28 +18,16 @@ CRC_SimulationClass::CRC_SimulationClass() {
 	beatFlashDuration = 150;
 	beatBrightness = 100;
 
-	restingBreaths = 16; //breaths per minute;
-	breathsMsCheck = 0;
-	breathBrightness = 0;
-	breathFadeTimecheck = millis();
-
 	motionActive = false;
 	perimeterActive = false;
 	turnSpeed = 160;
 	straightSpeed = 180;
+	straightVelocity = 1000;
 }
 void CRC_SimulationClass::tick() {
 	unsigned long now = millis();
-	switch (currentAnimation) {
-	case animationBio:
+	if (currentAnimation == animationBio) {
 		buttonHeartbeat(now);
-		ledBreath(now);
-		break;
-	case animationRunwayFwd:
-		//animationRunwayFwd(now);
-		break;
-	default:
-		break;
 	}
 }
 void CRC_SimulationClass::buttonHeartbeat(unsigned long &now) {
@@ -56,28 +44,14 @@ void CRC_SimulationClass::buttonHeartbeat(unsigned long &now) {
 	beatBrightness = getSineWave(beatAmplitude, beatsPerMS, beatTime);
 	crcLights.setButtonLevel(beatBrightness);
 }
-void CRC_SimulationClass::ledBreath(unsigned long &now) {
-	float breathsPM = ((restingBreaths * exertion) / 50) + restingBreaths;
-	float msPerBreath = 60000 / breathsPM;
-	float breathsPerMS = breathsPM / 60000;
-	const float breathAmplitude = 50;  //this number should be 1/2 the total max value
-	
-	if (now - msPerBreath > breathsMsCheck)
-	{
-		breathsMsCheck = now;
-		crcLights.setRandomColor();
-	}
-	unsigned long breathTime = now - breathsMsCheck;
-	//breathBrightness = breathAmplitude * sin(breathsPerMS * TWO_PI * breathTime - PI / 2) + breathAmplitude;
-	breathBrightness = getSineWave(breathAmplitude, breathsPerMS, breathTime);
-	breathFraction = breathBrightness / 100.00;
-	crcLights.setAllLeds(crcLights.color_R * breathFraction, crcLights.color_G * breathFraction, crcLights.color_B * breathFraction);
-}
 void CRC_SimulationClass::showLedNone() {
+	crcLights.show.stop();
 	crcLights.setAllOff();
 	currentAnimation = animationNone;
 }
 void CRC_SimulationClass::showLedBio() {
+	// Breathing at the resting rate, 16 breaths a minute
+	crcLights.show.play(CRC_LightShow::SHOW_BREATH);
 	currentAnimation = animationBio;
 }
 int CRC_SimulationClass::getSineWave(float amplitude, float periodMillis, long millis) {
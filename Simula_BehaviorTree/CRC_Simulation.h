@@ -23,19 +23,10 @@ private:
 	uint8_t beatBrightness;
 	void buttonHeartbeat(unsigned long &now);
 
-	//Breath related
-	uint8_t restingBreaths;
-	unsigned long breathsMsCheck;
-	int breathBrightness;
-	float breathFraction;
-	unsigned long breathFadeTimecheck;
-	void ledBreath(unsigned long &now);
-
-	//Lighting animations
+	//Lighting animations, the LED light shows themselves are in CRC_LightShow
 	uint8_t currentAnimation;
 	static const uint8_t animationNone = 0;
 	static const uint8_t animationBio = 1;
-	static const uint8_t animationRunwayFwd = 2;
 
 public:
 	CRC_SimulationClass();
@@ -50,6 +41,7 @@ public:
 	bool perimeterActive;
 	int turnSpeed;
 	int straightSpeed;
+	int32_t straightVelocity;	// Encoder pulses per second
 };
 
 extern CRC_SimulationClass simulation;
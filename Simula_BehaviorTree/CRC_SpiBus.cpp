@@ -0,0 +1,168 @@
+/***************************************************
+Uses: Owner of the shared SPI bus. Keeps the clock settings and
+chip select for each device, lets one device hold the bus across
+several transfers, defers interrupt driven users while the bus is
+taken and counts bytes and busy time per device.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#include "CRC_SpiBus.h"
+#include "CRC_Hardware.h"
+#include "CRC_Logger.h"
+#include "CRC_FastGpio.h"
+
+#define SPIBUS_NO_DEVICE	0xFF
+
+CRC_SpiBus::CRC_SpiBus() {
+	// The SD entry is unused, the SD library sets its own.
+	_settings[SPI_SD_CARD] = SPISettings(8000000, MSBFIRST, SPI_MODE0);
+	_settings[SPI_VS1053_CONTROL] = SPISettings(250000, MSBFIRST, SPI_MODE0);
+	_settings[SPI_VS1053_DATA] = SPISettings(8000000, MSBFIRST, SPI_MODE0);
+	_locks = 0;
+	_pending = false;
+	_releaseHandler = NULL;
+	_device = SPIBUS_NO_DEVICE;
+	_windowStart = 0;
+	memset((void *)_window, 0, sizeof(_window));
+	memset(_bytesPerSecond, 0, sizeof(_bytesPerSecond));
+	memset(_utilization, 0, sizeof(_utilization));
+}
+
+void CRC_SpiBus::begin() {
+	SPI.begin();
+	SPI.setDataMode(SPI_MODE0);
+	SPI.setBitOrder(MSBFIRST);
+	// Each device sets its own clock in its transaction, don't hold the
+	// default back for the slowest one.
+	SPI.setClockDivider(SPI_CLOCK_DIV2);
+	_windowStart = micros();
+}
+
+void CRC_SpiBus::setClock(uint8_t device, uint32_t hz) {
+	_settings[device] = SPISettings(hz, MSBFIRST, SPI_MODE0);
+}
+
+void CRC_SpiBus::acquire(uint8_t device) {
+	// Interrupt users always let go before returning, so from the main
+	// loop a free bus stays free until we take it.
+	if (_locks++ == 0) {
+		_device = device;
+		_lockStart = micros();
+	}
+}
+
+void CRC_SpiBus::release(uint16_t bytes) {
+	// Unowned traffic (_device is SPIBUS_NO_DEVICE) has no stats slot
+	if (_device < SPI_DEVICE_COUNT) {
+		_window[_device].bytes += bytes;
+	}
+	unlock();
+}
+
+void CRC_SpiBus::unlock() {
+	if (_locks > 1) {
+		_locks--;
+		return;
+	}
+	if (_device < SPI_DEVICE_COUNT) {
+		_window[_device].busyMicros += micros() - _lockStart;
+	}
+	_device = SPIBUS_NO_DEVICE;
+	_locks = 0;
+	if (_pending && _releaseHandler != NULL) {
+		_pending = false;
+		_releaseHandler();
+	}
+}
+
+void CRC_SpiBus::beginTransaction(uint8_t device) {
+	if (_locks != 0 && _device == device) {
+		_locks++;
+		return;
+	}
+	acquire(device);
+	SPI.beginTransaction(_settings[device]);
+}
+
+boolean CRC_SpiBus::tryBeginTransaction(uint8_t device) {
+	if (_locks != 0) {
+		_pending = true;
+		return false;
+	}
+	beginTransaction(device);
+	return true;
+}
+
+void CRC_SpiBus::endTransaction() {
+	if (_locks == 1) {
+		SPI.endTransaction();
+	}
+	unlock();
+}
+
+void CRC_SpiBus::setReleaseHandler(void(*handler)()) {
+	_releaseHandler = handler;
+}
+
+void CRC_SpiBus::select() {
+	switch (_device) {
+	case SPI_VS1053_CONTROL:
+		CRC_FastPin<CRC_HardwareClass::vs1053_cs>::low();
+		break;
+	case SPI_VS1053_DATA:
+		CRC_FastPin<CRC_HardwareClass::vs1053_dcs>::low();
+		break;
+	}
+}
+
+void CRC_SpiBus::deselect() {
+	switch (_device) {
+	case SPI_VS1053_CONTROL:
+		CRC_FastPin<CRC_HardwareClass::vs1053_cs>::high();
+		break;
+	case SPI_VS1053_DATA:
+		CRC_FastPin<CRC_HardwareClass::vs1053_dcs>::high();
+		break;
+	}
+}
+
+uint8_t CRC_SpiBus::transfer(uint8_t data) {
+	if (_device < SPI_DEVICE_COUNT) {
+		_window[_device].bytes++;
+	}
+	return SPI.transfer(data);
+}
+
+void CRC_SpiBus::transfer(void * buffer, uint16_t length) {
+	if (_device < SPI_DEVICE_COUNT) {
+		_window[_device].bytes += length;
+	}
+	SPI.transfer(buffer, length);
+}
+
+void CRC_SpiBus::tick() {
+	unsigned long now = micros();
+	unsigned long elapsed = now - _windowStart;
+	if (elapsed < 1000000UL) {
+		return;
+	}
+	_windowStart = now;
+	for (uint8_t device = 0; device < SPI_DEVICE_COUNT; device++) {
+		noInterrupts();
+		unsigned long bytes = _window[device].bytes;
+		unsigned long busy = _window[device].busyMicros;
+		_window[device].bytes = 0;
+		_window[device].busyMicros = 0;
+		interrupts();
+		_bytesPerSecond[device] = bytes * 1000UL / (elapsed / 1000UL);
+		_utilization[device] = busy / (elapsed / 1000UL);
+	}
+	crcLogger.logF(crcLogger.LOG_TRACE, F("SPI B/s %lu %lu %lu, busy %u %u %u permille"),
+		_bytesPerSecond[SPI_SD_CARD], _bytesPerSecond[SPI_VS1053_CONTROL], _bytesPerSecond[SPI_VS1053_DATA],
+		_utilization[SPI_SD_CARD], _utilization[SPI_VS1053_CONTROL], _utilization[SPI_VS1053_DATA]);
+}
@@ -0,0 +1,89 @@
+/***************************************************
+Uses: Owner of the shared SPI bus. Keeps the clock settings and
+chip select for each device, lets one device hold the bus across
+several transfers, defers interrupt driven users while the bus is
+taken and counts bytes and busy time per device.
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+****************************************************/
+
+#ifndef _CRC_SPIBUS_h
+#define _CRC_SPIBUS_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <SPI.h>
+
+class CRC_SpiBus {
+public:
+	enum SPI_DEVICE : uint8_t {
+		SPI_SD_CARD,			// Driven by the SD library, we only lock and count
+		SPI_VS1053_CONTROL,		// SCI, 250 kHz until the codec clock is up
+		SPI_VS1053_DATA,		// SDI, 8 MHz
+		SPI_DEVICE_COUNT
+	};
+
+private:
+	struct SPI_DEVICE_STATS {
+		unsigned long bytes;
+		unsigned long busyMicros;
+	};
+
+	SPISettings _settings[SPI_DEVICE_COUNT];
+	volatile uint8_t _locks;
+	volatile boolean _pending;
+	void(*_releaseHandler)();
+	uint8_t _device;
+	unsigned long _lockStart;
+	volatile SPI_DEVICE_STATS _window[SPI_DEVICE_COUNT];
+	unsigned long _windowStart;
+	unsigned long _bytesPerSecond[SPI_DEVICE_COUNT];
+	uint16_t _utilization[SPI_DEVICE_COUNT];
+
+	void unlock();
+public:
+	CRC_SpiBus();
+	void begin();
+	// Change a device's clock, e.g. once the codec's PLL is running.
+	void setClock(uint8_t device, uint32_t hz);
+
+	// Take the bus for a device. Nested begins for the same device share one
+	// transaction, so a batch of commands pays for the setup once. Different
+	// devices must not nest.
+	void beginTransaction(uint8_t device);
+	void endTransaction();
+	// Try to take the bus from an interrupt. If it is held, remember the
+	// request and run the release handler once the holder lets go.
+	boolean tryBeginTransaction(uint8_t device);
+	void setReleaseHandler(void(*handler)());
+
+	// Chip select for the device holding the bus.
+	void select();
+	void deselect();
+	uint8_t transfer(uint8_t data);
+	// Block transfer, received bytes overwrite the buffer.
+	void transfer(void * buffer, uint16_t length);
+
+	// Lock and account for code that drives the bus itself (the SD library).
+	void acquire(uint8_t device);
+	void release(uint16_t bytes = 0);
+	inline boolean busy() { return _locks != 0; }
+
+	// Once a second, refresh and trace log the per device figures.
+	void tick();
+	inline unsigned long bytesPerSecond(uint8_t device) { return _bytesPerSecond[device]; }
+	// Share of the last second the device held the bus, per mille.
+	inline uint16_t utilization(uint8_t device) { return _utilization[device]; }
+};
+
+extern CRC_SpiBus crcSpiBus;
+
+#endif
@@ -6,8 +6,12 @@
 
 #include "CRC_IP_Network.h"
 #include "CRC_Simulation.h"
+#include "CRC_SpiBus.h"
+#include "CRC_AudioCatalog.h"
+#include "CRC_AudioCache.h"
 #include "CRC_AudioManager.h"
 #include "CRC_PCA9635.h"
+#include "CRC_LightShow.h"
 #include "CRC_Lights.h"
 #include "CRC_Hardware.h"
 #include "CRC_Sensors.h"
@@ -21,6 +25,17 @@
 #include "CRC_ConfigurationManager.h"
 #include "CRC_ZigbeeController.h"
 #include "CRC_HttpClient.h"
+#include "CRC_SensorFilter.h"
+#include "CRC_ContactPredictor.h"
+#include "CRC_SensorHealth.h"
+#include "CRC_Odometry.h"
+#include "CRC_HeadingHold.h"
+#include "CRC_FastGpio.h"
+#include "CRC_Encoder.h"
+#include "CRC_IMU.h"
+#include "CRC_Orientation.h"
+#include "CRC_FixedMath.h"
+#include "CRC_Benchmark.h"
 #include <SPI.h>
 #include <SD.h>
 #include <Wire.h>
@@ -47,6 +62,10 @@ CRC_LoggerClass crcLogger;
 CRC_ConfigurationManagerClass crcConfigurationManager;
 CRC_ZigbeeController crcZigbeeWifi;
 CRC_HttpClient httpClient(crcZigbeeWifi);
+CRC_BenchmarkClass crcBenchmark;
+CRC_Odometry crcOdometry;
+CRC_HeadingHold crcHeadingHold;
+CRC_SpiBus crcSpiBus;
 String robotId = "";
 
 Behavior_Tree behaviorTree;
@@ -55,6 +74,8 @@ Behavior_Tree::Sequence sequence;
 Behavior_Tree::RandomSelector randomSort;
 Button_Gate buttonGateA(crcHardware.pinButtonA, "Button A"), buttonGateB(crcHardware.pinButtonB, "Button B");
 Battery_Check batteryCheck;
+Stall_Recovery stallRecovery(Stall_Recovery::RESPONSE_BACK_OFF);
+Edge_Fault_Hold edgeFaultHold;
 Cliff_Center cliffCenter;
 Cliff_Left cliffLeft;
 Cliff_Right cliffRight;
@@ -74,22 +95,25 @@ void setup() {
 
 	//Lots of setup work here
 	initializeSystem();
+
+#ifdef _CRC_BENCHMARK_
+	crcBenchmark.run();
+#endif
 	
 	//Behavior Tree construction. Visualize: https://www.gliffy.com/go/publish/10755293
 	behaviorTree.setRootChild(&sequence);
 	sequence.addChildren({ &buttonGateA, &buttonGateB });
 	buttonGateA.addChildren({ &batteryCheck, &orientationCheck, &selector[0], &randomSort });
-	selector[0].addChildren({ &perimeterCenter, &perimeterLeft, &perimeterRight, &cliffCenter, &cliffLeft, &cliffRight });
+	selector[0].addChildren({ &edgeFaultHold, &stallRecovery, &perimeterCenter, &perimeterLeft, &perimeterRight, &cliffCenter, &cliffLeft, &cliffRight });
 	randomSort.addChildren({ &forwardRandom, &doNothing, &turnLeft, &turnRight });
 
 	//Lighting display
 	crcLights.setRandomColor();
-	crcLights.showRunwayWithDelay();
+	crcLights.show.play(CRC_LightShow::SHOW_RUNWAY);
 
 	//MP3 Player & Amplifier
 	crcAudio.setAmpGain(1); //0 = low, 3 = high
 	crcAudio.setVolume(50, 50); //0 = loudest, 60 = softest ?
-	delay(2000);
 	crcZigbeeWifi.init(Serial2);
 	crcLogger.log(crcLogger.LOG_INFO, F("Setup complete."));
 
@@ -99,15 +123,20 @@ void setup() {
 	}
 
 	if (hardwareState.sdInitialized) {
-		crcAudio.playRandomAudio(F("effects/PwrUp_"), 10, F(".mp3"));
+		crcAudio.post(CRC_AudioCatalog::AUDIO_POWER_UP, crcAudio.AUDIO_PRIORITY_NORMAL, crcAudio.AUDIO_ENQUEUE);
 	}
 }
 
 void loop() {
 	crcAudio.tick();
+	crcSpiBus.tick();
 	simulation.tick();
+	crcLights.tick();
 	crcHardware.tick();
+	motors.tick();
 	toggleButtons();
+	crcOdometry.tick();
+	crcHeadingHold.tick();
 	
 	if (!behaviorTree.run()) {
 		crcLogger.log(crcLogger.LOG_INFO, F("All tree nodes returned false."));
@@ -127,7 +156,9 @@ void toggleButtons() {
 		if (!hardwareState.sensorsActive) {
 			activateSensors();
 		}
-		crcSensors.imu.read();
+		crcSensors.imu.readFifo();
+		crcSensors.orientation.update(crcSensors.imu);
+		crcSensors.tick();
 		if (!crcSensors.irReadingUpdated()) {
 			crcSensors.readIR();
 		}
@@ -151,7 +182,7 @@ void activateSensors() {
 }
 
 void deactivateSensors() {
-	motors.allStop();
+	motors.emergencyStop();
 	crcSensors.deactivate();
 	simulation.showLedNone();
 	crcLights.setButtonLevel(0);
@@ -162,6 +193,9 @@ void initializeSystem() {
 	crcHardware.announceBatteryVoltage();
 	crcLights.init();
 	crcAudio.init();
+	// The audio sectors and clip cache are the largest buffers, see what they leave
+	crcHardware.startScanStatus(millis());
+	crcLogger.logF(crcLogger.LOG_INFO, F("Free SRAM after audio init: %u bytes."), hardwareState.freeRam);
 	crcSensors.init();
 	if (!crcSensors.imu.begin())
 	{
@@ -175,6 +209,8 @@ void initializeSystem() {
 		crcSensors.imu.setupMag(crcSensors.imu.LSM9DS0_MAGGAIN_2GAUSS);
 		// 3.) Setup the gyroscope
 		crcSensors.imu.setupGyro(crcSensors.imu.LSM9DS0_GYROSCALE_245DPS);
+		// 4.) Buffer accel and gyro in the chip FIFOs at 100 Hz for the orientation filter
+		crcSensors.imu.enableFifo(CRC_IMU::IMU_ACCEL | CRC_IMU::IMU_GYRO, 100);
 		Serial.println(F("IMU configured."));
 	}	
 
@@ -189,6 +225,7 @@ void initializeSystem() {
 	{
 		crcLogger.log(crcLogger.LOG_INFO, F("SD card initialized."));
 		hardwareState.sdInitialized = true;
+		crcAudio.catalog.begin(crcHardware.sdcard_cs);
 	}
 }
 
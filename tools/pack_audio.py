@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Pack the Simula audio clips into a single AUDIO.PAK.
+
+Reads the clip directories of an SD card image (EFFECTS/PWRUP_NN.MP3 and
+so on) and writes AUDIO.PAK, with every clip starting on a 512 byte block
+boundary behind a one block header. Copy the result onto a freshly
+formatted card so the file is laid out contiguously. CRC_AudioCatalog then
+streams clips by raw block address instead of walking the FAT.
+
+Usage: pack_audio.py <sd card directory> [-o AUDIO.PAK]
+
+This file is designed for the Simula project by Chicago Robotics Corp.
+http://www.chicagorobotics.net/products
+
+Copyright (c) 2018, Chicago Robotics Corp.
+See README.md for license details
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+BLOCK = 512
+MAGIC = b"SPAK"
+VERSION = 1
+MAX_CLIPS = 32  # AUDIO_CATALOG_MAX_CLIPS
+
+# Same order as CRC_AudioCatalog::AUDIO_CATEGORY and AUDIO_CATEGORIES[]
+CATEGORIES = [
+    ("EFFECTS", "PWRUP_"),
+    ("EFFECTS", "PWRDN_"),
+    ("EMOTIONS", "SCARE_"),
+]
+
+HEADER = struct.Struct("<4sBBH")     # magic, version, clip count, reserved
+ENTRY = struct.Struct("<BBHII")      # category, number, reserved, block offset, size
+
+
+def find_directory(root, name):
+    # FAT ignores case, so a card written elsewhere may hold effects/ rather than EFFECTS/
+    for entry in sorted(os.listdir(root)):
+        path = os.path.join(root, entry)
+        if entry.upper() == name and os.path.isdir(path):
+            return path
+    return None
+
+
+def find_clips(root):
+    clips = []
+    for category, (directory, prefix) in enumerate(CATEGORIES):
+        path = find_directory(root, directory)
+        if path is None:
+            print("warning: %s missing" % os.path.join(root, directory), file=sys.stderr)
+            continue
+        pattern = re.compile(re.escape(prefix) + r"(\d\d)\.MP3$", re.IGNORECASE)
+        for name in sorted(os.listdir(path)):
+            match = pattern.match(name)
+            if match:
+                clips.append((category, int(match.group(1)), os.path.join(path, name)))
+    return clips
+
+
+def pack(clips, output):
+    if len(clips) > MAX_CLIPS:
+        sys.exit("error: %d clips, the catalog holds %d" % (len(clips), MAX_CLIPS))
+    if HEADER.size + ENTRY.size * len(clips) > BLOCK:
+        sys.exit("error: header does not fit in one block")
+
+    entries = []
+    data = bytearray()
+    offset = 1
+    for category, number, path in clips:
+        with open(path, "rb") as clip:
+            audio = clip.read()
+        entries.append(ENTRY.pack(category, number, 0, offset, len(audio)))
+        padding = -len(audio) % BLOCK
+        data += audio + b"\0" * padding
+        offset += (len(audio) + padding) // BLOCK
+
+    header = HEADER.pack(MAGIC, VERSION, len(clips), 0) + b"".join(entries)
+    with open(output, "wb") as out:
+        out.write(header.ljust(BLOCK, b"\0"))
+        out.write(data)
+    print("%s: %d clips, %d blocks" % (output, len(clips), offset))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack Simula audio clips into AUDIO.PAK")
+    parser.add_argument("root", help="directory holding the SD card contents")
+    parser.add_argument("-o", "--output", help="pack to write, default <root>/AUDIO.PAK")
+    args = parser.parse_args()
+    pack(find_clips(args.root), args.output or os.path.join(args.root, "AUDIO.PAK"))
+
+
+if __name__ == "__main__":
+    main()